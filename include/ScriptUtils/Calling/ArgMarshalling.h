@@ -0,0 +1,148 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_ARGMARSHALLING
+#define H_SCRIPTUTILS_ARGMARSHALLING
+
+#include <angelscript.h>
+
+#include <utility>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Returns true if the type-id is an object type (or handle to one)
+	inline bool is_object_typeid(int typeId)
+	{
+		return (typeId & asTYPEID_MASK_OBJECT) != 0;
+	}
+
+	//! Returns true if the type-id is a script enum (enums are passed as 32-bit ints)
+	inline bool is_enum_typeid(int typeId)
+	{
+		return !is_object_typeid(typeId) && typeId > asTYPEID_DOUBLE;
+	}
+
+	//! Returns true if the script may write to the param: a non-const &out or &inout reference
+	inline bool is_writable_ref(asDWORD flags)
+	{
+		return (flags & asTM_OUTREF) != 0 && (flags & asTM_CONST) == 0;
+	}
+
+	//! How a C++ object is given to an object-typed script parameter
+	enum ObjectArgMode
+	{
+		//! The address of the C++ object is passed: const &in, &out and &inout params (for the latter the object must be writable)
+		ArgByAddress,
+		//! Passed with SetArgObject(), which copies by-value params (the script owns them) and adds a ref for handles
+		ArgByObject,
+		//! A copy is made for the call: non-const &in params, which the script is allowed to modify
+		ArgByCopy
+	};
+
+	//! Works out how an object arg should be passed, from the param's type-id and flags (see asIScriptFunction#GetParamTypeId())
+	inline ObjectArgMode object_arg_mode(int typeId, asDWORD flags)
+	{
+		if ((flags & asTM_INOUTREF) == 0 || (typeId & asTYPEID_OBJHANDLE))
+			return ArgByObject;
+		if ((flags & asTM_INOUTREF) == asTM_INREF && (flags & asTM_CONST) == 0)
+			return ArgByCopy;
+		return ArgByAddress;
+	}
+
+	//! As object_arg_mode(), but copies all &in args: for calls that may outlive the C++ args (e.g. ones that suspend)
+	inline ObjectArgMode deferred_object_arg_mode(int typeId, asDWORD flags)
+	{
+		ObjectArgMode mode = object_arg_mode(typeId, flags);
+		if (mode == ArgByAddress && (flags & asTM_INOUTREF) == asTM_INREF)
+			return ArgByCopy;
+		return mode;
+	}
+
+	//! Owns the copies made for ArgByCopy args until the call they were made for is over
+	/*!
+	* Nothing is allocated unless a copy is actually made.
+	*/
+	class ArgCopies
+	{
+	public:
+		ArgCopies()
+			: _engine(nullptr)
+		{}
+
+		~ArgCopies()
+		{
+			release();
+		}
+
+		//! Copies the object with the engine, returning the copy (or null if it couldn't be copied)
+		void *copy(asIScriptEngine *engine, const void *obj, int typeId)
+		{
+			void *copy = engine->CreateScriptObjectCopy(const_cast<void*>(obj), typeId);
+			if (copy != nullptr)
+			{
+				_engine = engine;
+				_copies.push_back(std::make_pair(copy, typeId));
+			}
+			return copy;
+		}
+
+		//! Destroys the copies (call once the context is done with them)
+		void release()
+		{
+			for (auto it = _copies.begin(), end = _copies.end(); it != end; ++it)
+				_engine->ReleaseScriptObject(it->first, it->second);
+			_copies.clear();
+		}
+
+		bool empty() const
+		{
+			return _copies.empty();
+		}
+
+		void swap(ArgCopies &other)
+		{
+			std::swap(_engine, other._engine);
+			_copies.swap(other._copies);
+		}
+
+	private:
+		//! Prevent copying
+		ArgCopies(const ArgCopies &);
+		//! Prevent copying
+		ArgCopies & operator=(const ArgCopies &);
+
+		asIScriptEngine *_engine;
+		std::vector<std::pair<void*, int>> _copies;
+	};
+
+	//! Sets an object arg on a prepared context using the given mode
+	/*!
+	* \param[in] copies
+	* Holds the copy if one is made (ArgByCopy); it must be kept until the
+	* context has finished with the arg.
+	*/
+	inline int set_object_arg(asIScriptContext *ctx, asUINT arg, const void *obj, int typeId, ObjectArgMode mode, ArgCopies &copies)
+	{
+		switch (mode)
+		{
+		case ArgByAddress:
+			return ctx->SetArgAddress(arg, const_cast<void*>(obj));
+		case ArgByCopy:
+			{
+				void *copy = copies.copy(ctx->GetEngine(), obj, typeId);
+				return copy != nullptr ? ctx->SetArgAddress(arg, copy) : asERROR;
+			}
+		default:
+			return ctx->SetArgObject(arg, const_cast<void*>(obj));
+		}
+	}
+
+}}
+
+#endif
@@ -0,0 +1,554 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_ASYNCCALLER
+#define H_SCRIPTUTILS_ASYNCCALLER
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+#include "ContextPool.h"
+#include "TypedCaller.h"
+
+#include <boost/optional.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define SCRIPTUTILS_HAS_COROUTINES
+#endif
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Suspends the script that calls it (see RegisterYield())
+	inline void ScriptYield()
+	{
+		asIScriptContext *ctx = asGetActiveContext();
+		if (ctx != nullptr)
+			ctx->Suspend();
+	}
+
+	//! Registers ScriptYield() as a global script function
+	/*!
+	* Scripts started with an AsyncCaller can call it to give up the rest of
+	* the frame; they're resumed by the next ScriptScheduler#Update().
+	*/
+	inline int RegisterYield(asIScriptEngine *engine, const char *decl = "void yield()")
+	{
+		return engine->RegisterGlobalFunction(decl, asFUNCTION(ScriptYield), asCALL_CDECL);
+	}
+
+	//! The state of a script call started by an AsyncCaller (shared by the AsyncCall handles)
+	class AsyncStateBase
+	{
+	public:
+		enum Status
+		{
+			//! Still executing (the context is suspended)
+			Running,
+			//! Finished; the result is available
+			Finished,
+			//! Stopped by a script exception, an abort or an error
+			Failed
+		};
+
+		AsyncStateBase(asIScriptContext *context, int return_type_id, asDWORD return_flags)
+			: ctx(context), returnTypeId(return_type_id), returnFlags(return_flags), status(Running), result(asEXECUTION_SUSPENDED)
+		{}
+
+		virtual ~AsyncStateBase()
+		{
+			if (ctx != nullptr)
+				ReturnContext(ctx);
+		}
+
+		//! Runs the script until it finishes or suspends again
+		/*!
+		* \returns
+		* True if the script is still running (i.e. it suspended)
+		*/
+		bool step()
+		{
+			result = ctx->Execute();
+			if (result == asEXECUTION_SUSPENDED)
+				return true;
+
+			if (result == asEXECUTION_FINISHED)
+			{
+				store_result();
+				status = Finished;
+			}
+			else
+			{
+				if (result == asEXECUTION_EXCEPTION)
+					message = std::string("Script Exception: ") + ctx->GetExceptionString();
+				else
+					message = "Script execution was aborted or failed";
+				status = Failed;
+			}
+			finish();
+			return false;
+		}
+
+		//! Stops a running script
+		void abort()
+		{
+			if (status != Running)
+				return;
+			ctx->Abort();
+			result = asEXECUTION_ABORTED;
+			message = "Script execution was aborted";
+			status = Failed;
+			finish();
+		}
+
+		void set_continuation(std::function<void ()> fn)
+		{
+			if (status != Running)
+				fn();
+			else
+				continuation = std::move(fn);
+		}
+
+		asIScriptContext *ctx;
+		int returnTypeId;
+		asDWORD returnFlags;
+
+		Status status;
+		//! The last value returned by Execute()
+		int result;
+		std::string message;
+
+		std::function<void ()> continuation;
+
+		//! Copies of the args, which have to live as long as the call
+		ArgCopies copies;
+
+	protected:
+		//! Copies the return value out of ctx before it's returned to the pool
+		virtual void store_result() = 0;
+
+	private:
+		void finish()
+		{
+			ReturnContext(ctx);
+			ctx = nullptr;
+			copies.release();
+
+			if (continuation)
+			{
+				std::function<void ()> fn;
+				fn.swap(continuation);
+				fn();
+			}
+		}
+	};
+
+	template <typename R>
+	class AsyncState : public AsyncStateBase
+	{
+	public:
+		AsyncState(asIScriptContext *context, int return_type_id, asDWORD return_flags)
+			: AsyncStateBase(context, return_type_id, return_flags)
+		{}
+
+		boost::optional<R> value;
+
+	protected:
+		void store_result()
+		{
+			value = ScriptReturnTraits<R>::get(ctx, returnTypeId, returnFlags);
+		}
+	};
+
+	template <>
+	class AsyncState<void> : public AsyncStateBase
+	{
+	public:
+		AsyncState(asIScriptContext *context, int return_type_id, asDWORD return_flags)
+			: AsyncStateBase(context, return_type_id, return_flags)
+		{}
+
+	protected:
+		void store_result() {}
+	};
+
+	//! Resumes suspended script calls started by AsyncCallers
+	/*!
+	* Call Update() once per frame (or whenever scripts should get more time):
+	* each suspended script is resumed once, in the order it was started. When a
+	* script finishes its AsyncCall completes, and any continuation (or awaiting
+	* coroutine) is run from within Update().
+	* <p>
+	* The scheduler is not thread-safe - use it from one thread.
+	* </p>
+	*/
+	class ScriptScheduler
+	{
+	public:
+		typedef std::shared_ptr<AsyncStateBase> state_ptr;
+
+		ScriptScheduler()
+		{}
+
+		//! Destructor - aborts any scripts that are still running
+		~ScriptScheduler()
+		{
+			AbortAll();
+		}
+
+		//! Resumes each suspended script once
+		/*!
+		* Calls started by continuations during this update are resumed on the
+		* next update.
+		*
+		* \returns
+		* The number of scripts that are still running
+		*/
+		size_t Update()
+		{
+			std::vector<state_ptr> running;
+			running.swap(_running);
+			for (auto it = running.begin(), end = running.end(); it != end; ++it)
+			{
+				if ((*it)->status == AsyncStateBase::Running && (*it)->step())
+					_running.push_back(*it);
+			}
+			return _running.size();
+		}
+
+		//! Aborts all running scripts (their AsyncCalls fail)
+		void AbortAll()
+		{
+			std::vector<state_ptr> running;
+			running.swap(_running);
+			for (auto it = running.begin(), end = running.end(); it != end; ++it)
+				(*it)->abort();
+		}
+
+		//! Number of scripts waiting to be resumed
+		size_t GetRunningCount() const
+		{
+			return _running.size();
+		}
+
+		//! Starts a call: runs it until it finishes or suspends (used by AsyncCaller)
+		void Start(const state_ptr &state)
+		{
+			if (state->step())
+				_running.push_back(state);
+		}
+
+	private:
+		//! Prevent copying
+		ScriptScheduler(const ScriptScheduler &);
+		//! Prevent copying
+		ScriptScheduler & operator=(const ScriptScheduler &);
+
+		std::vector<state_ptr> _running;
+	};
+
+	//! Handle to a script call started by an AsyncCaller
+	template <typename R>
+	class AsyncCall
+	{
+	public:
+		AsyncCall()
+		{}
+
+		explicit AsyncCall(const std::shared_ptr<AsyncState<R>> &state)
+			: _state(state)
+		{}
+
+		//! Returns true once the script has finished or failed
+		bool is_done() const
+		{
+			return _state && _state->status != AsyncStateBase::Running;
+		}
+
+		//! Returns true if the script finished (without an exception)
+		bool succeeded() const
+		{
+			return _state && _state->status == AsyncStateBase::Finished;
+		}
+
+		//! Returns the error message if the call failed
+		const std::string &get_error() const
+		{
+			return _state->message;
+		}
+
+		//! Returns the result
+		/*!
+		* Throws an Exception if the script failed or hasn't finished yet.
+		*/
+		R get() const
+		{
+			check_finished();
+			return get_value();
+		}
+
+		//! Sets a function to run when the script finishes or fails
+		/*!
+		* Runs it immediately if the script is already done. Only one
+		* continuation can be set.
+		*/
+		void then(std::function<void ()> fn)
+		{
+			_state->set_continuation(std::move(fn));
+		}
+
+		//! Aborts the script if it's still running
+		void abort()
+		{
+			if (_state)
+				_state->abort();
+		}
+
+	private:
+		void check_finished() const
+		{
+			if (!_state)
+				throw Exception("AsyncCall: no call");
+			if (_state->status == AsyncStateBase::Running)
+				throw Exception("AsyncCall: the script hasn't finished");
+			if (_state->status == AsyncStateBase::Failed)
+				throw Exception(_state->message);
+		}
+
+		template <typename T>
+		struct tag {};
+
+		R get_value() const
+		{
+			return get_value(tag<R>());
+		}
+
+		template <typename T>
+		T get_value(tag<T>) const
+		{
+			return *_state->value;
+		}
+
+		void get_value(tag<void>) const
+		{
+		}
+
+		std::shared_ptr<AsyncState<R>> _state;
+	};
+
+	template <typename Signature>
+	class AsyncCaller;
+
+	//! Starts script calls that may suspend, returning an AsyncCall for each
+	/*!
+	* Each call borrows a context (see AcquireContext()) and runs the script
+	* straight away; if the script suspends (e.g. by calling a registered
+	* ScriptYield()) the context is handed to the ScriptScheduler, which resumes
+	* it on later updates. The context is given back when the script finishes.
+	*
+	* \code
+	* AsyncCaller<int (int)> think = AsyncCaller<int (int)>::Create(module, "int Think(int)");
+	* AsyncCall<int> call = think(scheduler, 3);
+	* call.then([=] { use(call.get()); });
+	* // each frame:
+	* scheduler.Update();
+	* \endcode
+	*
+	* With C++20 coroutines an AsyncCall can also be awaited:
+	* <code>int r = co_await think(scheduler, 3);</code>
+	*/
+	template <typename R, typename... Args>
+	class AsyncCaller<R (Args...)>
+	{
+		typedef void (AsyncCaller::*safe_bool)() const;
+		void this_type_does_not_support_comparisons() const {}
+	public:
+		AsyncCaller()
+			: _func(nullptr), _obj(nullptr), _returnTypeId(asTYPEID_VOID), _returnFlags(0)
+		{}
+
+		//! Constructor
+		/*!
+		* The signature is checked as it is for TypedCaller (an Exception is
+		* thrown if it doesn't match).
+		*/
+		AsyncCaller(asIScriptFunction *function, asIScriptObject *obj = nullptr)
+			: _func(function), _obj(obj), _returnTypeId(asTYPEID_VOID), _returnFlags(0)
+		{
+			if (_func != nullptr)
+			{
+				std::string error;
+				if (!SignatureTraits<R (Args...)>::matches(_func, &error))
+					throw Exception("AsyncCaller: " + error);
+				_returnTypeId = _func->GetReturnTypeId(&_returnFlags);
+				// The context is given back as soon as the result is stored
+				if (!DetachedReturn<R>::accepts(_returnTypeId, _returnFlags))
+					throw Exception(std::string("AsyncCaller: ") + _func->GetDeclaration() +
+						" returns an object that's released with the context, so it can't be returned as a pointer - use ScriptHandle<T>");
+				// The script may suspend, so the args can't be referred to in place
+				_boundArgs = SignatureTraits<R (Args...)>::bind_args(_func, &deferred_object_arg_mode);
+			}
+			add_ref();
+		}
+
+		//! Copy constructor
+		AsyncCaller(const AsyncCaller &other)
+			: _func(other._func), _obj(other._obj), _returnTypeId(other._returnTypeId), _returnFlags(other._returnFlags), _boundArgs(other._boundArgs)
+		{
+			add_ref();
+		}
+
+		//! Destructor
+		~AsyncCaller()
+		{
+			release();
+		}
+
+		//! Copy-assignment operator
+		AsyncCaller& operator= (const AsyncCaller &other)
+		{
+			if (this != &other)
+			{
+				release();
+				_func = other._func;
+				_obj = other._obj;
+				_returnTypeId = other._returnTypeId;
+				_returnFlags = other._returnFlags;
+				_boundArgs = other._boundArgs;
+				add_ref();
+			}
+			return *this;
+		}
+
+		//! Creates a caller for a global method
+		static AsyncCaller Create(asIScriptEngine *engine, const std::string& method_decl)
+		{
+			return AsyncCaller(engine->GetGlobalFunctionByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for a global method
+		static AsyncCaller Create(asIScriptModule *module, const std::string& method_decl)
+		{
+			return AsyncCaller(module->GetFunctionByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for an object method
+		static AsyncCaller Create(asIScriptObject *object, const std::string& method_decl)
+		{
+			return AsyncCaller(object->GetObjectType()->GetMethodByDecl(method_decl.c_str()), object);
+		}
+
+		bool is_ok() const
+		{
+			return _func != nullptr;
+		}
+
+		operator safe_bool() const
+		{
+			return is_ok() ? &AsyncCaller::this_type_does_not_support_comparisons : 0;
+		}
+
+		//! Starts a call
+		/*!
+		* The script runs until it finishes or suspends before this returns.
+		* Object args are copied for the call, except for &out / &inout params,
+		* which are passed by address and so have to outlive it.
+		*/
+		AsyncCall<R> operator()(ScriptScheduler &scheduler, Args... args) const
+		{
+			if (_func == nullptr)
+				throw Exception("Can't execute - AsyncCaller is not valid");
+
+			asIScriptContext *ctx = AcquireContext(_func->GetEngine());
+			if (ctx == nullptr)
+				throw Exception("AsyncCaller: failed to create a script context");
+
+			// The state owns the context from here on
+			std::shared_ptr<AsyncState<R>> state = std::make_shared<AsyncState<R>>(ctx, _returnTypeId, _returnFlags);
+			if (ctx->Prepare(_func) < 0 || (_obj != nullptr && ctx->SetObject(_obj) < 0))
+				throw Exception(std::string("Can't execute ") + _func->GetDeclaration() + " - failed to prepare the context");
+			SignatureTraits<R (Args...)>::set_args(ctx, _boundArgs, state->copies, args...);
+
+			scheduler.Start(state);
+			return AsyncCall<R>(state);
+		}
+
+	private:
+		void add_ref()
+		{
+			if (_func != nullptr)
+				_func->AddRef();
+			if (_obj != nullptr)
+				_obj->AddRef();
+		}
+
+		void release()
+		{
+			if (_func != nullptr)
+				_func->Release();
+			if (_obj != nullptr)
+				_obj->Release();
+			_func = nullptr;
+			_obj = nullptr;
+		}
+
+		asIScriptFunction *_func;
+		asIScriptObject *_obj;
+		int _returnTypeId;
+		asDWORD _returnFlags;
+		typename SignatureTraits<R (Args...)>::bound_args _boundArgs;
+	};
+
+#ifdef SCRIPTUTILS_HAS_COROUTINES
+	//! Lets a C++20 coroutine co_await an AsyncCall
+	/*!
+	* The coroutine is resumed from ScriptScheduler#Update() when the script
+	* finishes; co_await returns the result, or throws if the script failed.
+	*/
+	template <typename R>
+	class AsyncCallAwaiter
+	{
+	public:
+		explicit AsyncCallAwaiter(AsyncCall<R> call)
+			: _call(std::move(call))
+		{}
+
+		bool await_ready() const
+		{
+			return _call.is_done();
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			_call.then([handle] { handle.resume(); });
+		}
+
+		R await_resume()
+		{
+			return _call.get();
+		}
+
+	private:
+		AsyncCall<R> _call;
+	};
+
+	template <typename R>
+	AsyncCallAwaiter<R> operator co_await(AsyncCall<R> call)
+	{
+		return AsyncCallAwaiter<R>(std::move(call));
+	}
+#endif
+
+}}
+
+#endif
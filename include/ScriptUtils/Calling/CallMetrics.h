@@ -0,0 +1,487 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_CALLMETRICS
+#define H_SCRIPTUTILS_CALLMETRICS
+
+#include <angelscript.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Merged metrics for one script function (see CallMetrics#Snapshot())
+	struct FunctionMetrics
+	{
+		//! Number of buckets in the latency histogram
+		static const size_t bucket_count = 280;
+
+		int function_id;
+		//! Executions, including ones that threw or suspended
+		std::uint64_t calls;
+		std::uint64_t exceptions;
+		std::uint64_t suspends;
+		std::uint64_t total_ns;
+		std::uint64_t max_ns;
+		//! Latency histogram (see bucket_lower_bound())
+		std::vector<std::uint64_t> histogram;
+
+		FunctionMetrics()
+			: function_id(0), calls(0), exceptions(0), suspends(0), total_ns(0), max_ns(0), histogram(bucket_count, 0)
+		{}
+
+		double mean_ns() const
+		{
+			return calls > 0 ? double(total_ns) / calls : 0.0;
+		}
+
+		//! Returns (an upper estimate of) the given percentile (0 - 100) of the latency, in ns
+		std::uint64_t percentile_ns(double percentile) const
+		{
+			if (calls == 0)
+				return 0;
+			std::uint64_t target = std::uint64_t(percentile / 100.0 * calls + 0.5);
+			if (target == 0)
+				target = 1;
+			std::uint64_t seen = 0;
+			for (size_t i = 0; i < bucket_count; ++i)
+			{
+				seen += histogram[i];
+				if (seen >= target)
+				{
+					std::uint64_t upper = i + 1 < bucket_count ? bucket_lower_bound(i + 1) - 1 : max_ns;
+					return upper < max_ns ? upper : max_ns;
+				}
+			}
+			return max_ns;
+		}
+
+		//! Histogram bucket for a latency: exact below 8ns, then 8 buckets per power of two (within 12.5%)
+		static size_t bucket_index(std::uint64_t ns)
+		{
+			if (ns < 8)
+				return size_t(ns);
+			unsigned int exponent = 63;
+			while ((ns >> exponent) == 0)
+				--exponent;
+			size_t index = 8 + (exponent - 3) * 8 + size_t((ns >> (exponent - 3)) & 7);
+			return index < bucket_count ? index : bucket_count - 1;
+		}
+
+		//! The smallest latency that goes in the given bucket
+		static std::uint64_t bucket_lower_bound(size_t index)
+		{
+			if (index < 8)
+				return index;
+			unsigned int exponent = unsigned(index - 8) / 8 + 3;
+			return (std::uint64_t(8 + (index - 8) % 8)) << (exponent - 3);
+		}
+	};
+
+	//! Opt-in per-function call metrics, recorded by the callers and broadcasts (see Execute())
+	/*!
+	* Off by default; when off, execute() only pays for one relaxed atomic load.
+	* When on, each execution records its latency in a log-linear (HDR-style)
+	* histogram, and counts calls, exceptions and suspends, keyed by function
+	* id.
+	* <p>
+	* Each thread records into its own table with plain relaxed atomic loads and
+	* stores (it's the only writer), so recording takes no locks. Snapshot()
+	* merges the tables of all threads - including ones that have exited - on
+	* demand.
+	* </p>
+	*
+	* \code
+	* CallMetrics::Enable(true);
+	* ...
+	* CallMetrics::WriteText(std::cout, engine);
+	* \endcode
+	*/
+	class CallMetrics
+	{
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		static void Enable(bool enable)
+		{
+			enabled_flag().store(enable, std::memory_order_relaxed);
+		}
+
+		static bool IsEnabled()
+		{
+			return enabled_flag().load(std::memory_order_relaxed);
+		}
+
+		//! Records an execution of the given function on the calling thread
+		/*!
+		* \param[in] result
+		* The value returned by asIScriptContext#Execute()
+		*/
+		static void Record(int function_id, clock::duration elapsed, int result)
+		{
+			function_slot &slot = local().find(function_id);
+			std::uint64_t ns = std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+			increment(slot.calls);
+			if (result == asEXECUTION_EXCEPTION)
+				increment(slot.exceptions);
+			else if (result == asEXECUTION_SUSPENDED)
+				increment(slot.suspends);
+			slot.total_ns.store(slot.total_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+			if (ns > slot.max_ns.load(std::memory_order_relaxed))
+				slot.max_ns.store(ns, std::memory_order_relaxed);
+			increment(slot.histogram[FunctionMetrics::bucket_index(ns)]);
+		}
+
+		//! Executes the prepared context, recording the call if metrics are enabled
+		/*!
+		* \returns
+		* The value returned by asIScriptContext#Execute()
+		*/
+		static int Execute(asIScriptContext *ctx, asIScriptFunction *function)
+		{
+			if (!IsEnabled())
+				return ctx->Execute();
+			clock::time_point start = clock::now();
+			int r = ctx->Execute();
+			Record(function->GetId(), clock::now() - start, r);
+			return r;
+		}
+
+		//! Merges the metrics of all threads, ordered by function id
+		static std::vector<FunctionMetrics> Snapshot()
+		{
+			std::map<int, FunctionMetrics> merged;
+			{
+				registry &reg = get_registry();
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				for (auto it = reg.retired.begin(), end = reg.retired.end(); it != end; ++it)
+					add(merged[it->first], it->second);
+				for (auto it = reg.threads.begin(), end = reg.threads.end(); it != end; ++it)
+					(*it)->merge_into(merged);
+			}
+
+			std::vector<FunctionMetrics> result;
+			result.reserve(merged.size());
+			for (auto it = merged.begin(), end = merged.end(); it != end; ++it)
+			{
+				it->second.function_id = it->first;
+				result.push_back(it->second);
+			}
+			return result;
+		}
+
+		//! Clears all metrics
+		/*!
+		* Counts recorded by other threads while this runs may be lost.
+		*/
+		static void Reset()
+		{
+			registry &reg = get_registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			reg.retired.clear();
+			for (auto it = reg.threads.begin(), end = reg.threads.end(); it != end; ++it)
+				(*it)->clear();
+		}
+
+		//! Writes a snapshot as a text table (functions are named using the engine, if given)
+		static void WriteText(std::ostream &stream, asIScriptEngine *engine = nullptr)
+		{
+			std::vector<FunctionMetrics> metrics = Snapshot();
+			stream << "     calls   except  suspend    mean ns     p50 ns     p99 ns     max ns  function\n";
+			for (auto it = metrics.begin(), end = metrics.end(); it != end; ++it)
+			{
+				char row[128];
+				std::snprintf(row, sizeof(row), "%10llu %8llu %8llu %10.0f %10llu %10llu %10llu  ",
+					(unsigned long long)it->calls, (unsigned long long)it->exceptions, (unsigned long long)it->suspends,
+					it->mean_ns(), (unsigned long long)it->percentile_ns(50), (unsigned long long)it->percentile_ns(99),
+					(unsigned long long)it->max_ns);
+				stream << row << function_name(engine, it->function_id) << '\n';
+			}
+		}
+
+		//! Writes a snapshot as a JSON array (histograms list only the non-empty buckets, as [lower bound ns, count])
+		static void WriteJson(std::ostream &stream, asIScriptEngine *engine = nullptr)
+		{
+			std::vector<FunctionMetrics> metrics = Snapshot();
+			stream << '[';
+			for (auto it = metrics.begin(), end = metrics.end(); it != end; ++it)
+			{
+				if (it != metrics.begin())
+					stream << ',';
+				stream << "{\"id\":" << it->function_id
+					<< ",\"function\":\"" << json_escape(function_name(engine, it->function_id)) << '"'
+					<< ",\"calls\":" << it->calls
+					<< ",\"exceptions\":" << it->exceptions
+					<< ",\"suspends\":" << it->suspends
+					<< ",\"total_ns\":" << it->total_ns
+					<< ",\"max_ns\":" << it->max_ns
+					<< ",\"p50_ns\":" << it->percentile_ns(50)
+					<< ",\"p99_ns\":" << it->percentile_ns(99)
+					<< ",\"histogram\":[";
+				bool first = true;
+				for (size_t i = 0; i < FunctionMetrics::bucket_count; ++i)
+				{
+					if (it->histogram[i] == 0)
+						continue;
+					if (!first)
+						stream << ',';
+					first = false;
+					stream << '[' << FunctionMetrics::bucket_lower_bound(i) << ',' << it->histogram[i] << ']';
+				}
+				stream << "]}";
+			}
+			stream << "]\n";
+		}
+
+	private:
+		typedef std::atomic<std::uint64_t> counter;
+
+		struct function_slot
+		{
+			counter calls;
+			counter exceptions;
+			counter suspends;
+			counter total_ns;
+			counter max_ns;
+			counter histogram[FunctionMetrics::bucket_count];
+
+			function_slot()
+				: calls(0), exceptions(0), suspends(0), total_ns(0), max_ns(0)
+			{
+				for (size_t i = 0; i < FunctionMetrics::bucket_count; ++i)
+					histogram[i].store(0, std::memory_order_relaxed);
+			}
+		};
+
+		//! Open-addressed table of function slots; full tables chain to another
+		struct slot_table
+		{
+			static const size_t size = 256;
+
+			//! function id + 1 (0 is empty)
+			std::atomic<int> keys[size];
+			std::atomic<function_slot*> slots[size];
+			std::atomic<slot_table*> next;
+
+			slot_table()
+				: next(nullptr)
+			{
+				for (size_t i = 0; i < size; ++i)
+				{
+					keys[i].store(0, std::memory_order_relaxed);
+					slots[i].store(nullptr, std::memory_order_relaxed);
+				}
+			}
+
+			~slot_table()
+			{
+				for (size_t i = 0; i < size; ++i)
+					delete slots[i].load(std::memory_order_relaxed);
+				delete next.load(std::memory_order_relaxed);
+			}
+		};
+
+		//! One thread's metrics; only that thread writes to it
+		class thread_metrics
+		{
+		public:
+			thread_metrics()
+				: _lastKey(0), _lastSlot(nullptr)
+			{
+				registry &reg = get_registry();
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				reg.threads.push_back(this);
+			}
+
+			~thread_metrics()
+			{
+				registry &reg = get_registry();
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				merge_into(reg.retired);
+				for (auto it = reg.threads.begin(), end = reg.threads.end(); it != end; ++it)
+				{
+					if (*it == this)
+					{
+						reg.threads.erase(it);
+						break;
+					}
+				}
+			}
+
+			function_slot &find(int function_id)
+			{
+				const int key = function_id + 1;
+				if (key == _lastKey)
+					return *_lastSlot;
+
+				slot_table *table = &_table;
+				for (;;)
+				{
+					size_t start = (unsigned int)key * 2654435761u % slot_table::size;
+					for (size_t i = 0; i < slot_table::size; ++i)
+					{
+						size_t index = (start + i) % slot_table::size;
+						int existing = table->keys[index].load(std::memory_order_relaxed);
+						if (existing == key)
+							return remember(key, table->slots[index].load(std::memory_order_relaxed));
+						if (existing == 0)
+						{
+							// Publish the slot before the key, so that readers never see a key without a slot
+							function_slot *slot = new function_slot;
+							table->slots[index].store(slot, std::memory_order_release);
+							table->keys[index].store(key, std::memory_order_release);
+							return remember(key, slot);
+						}
+					}
+
+					slot_table *next = table->next.load(std::memory_order_relaxed);
+					if (next == nullptr)
+					{
+						next = new slot_table;
+						table->next.store(next, std::memory_order_release);
+					}
+					table = next;
+				}
+			}
+
+			void merge_into(std::map<int, FunctionMetrics> &merged) const
+			{
+				for (const slot_table *table = &_table; table != nullptr; table = table->next.load(std::memory_order_acquire))
+				{
+					for (size_t i = 0; i < slot_table::size; ++i)
+					{
+						int key = table->keys[i].load(std::memory_order_acquire);
+						if (key != 0)
+							add(merged[key - 1], *table->slots[i].load(std::memory_order_acquire));
+					}
+				}
+			}
+
+			void clear()
+			{
+				for (slot_table *table = &_table; table != nullptr; table = table->next.load(std::memory_order_acquire))
+				{
+					for (size_t i = 0; i < slot_table::size; ++i)
+					{
+						if (table->keys[i].load(std::memory_order_acquire) == 0)
+							continue;
+						function_slot &slot = *table->slots[i].load(std::memory_order_acquire);
+						slot.calls.store(0, std::memory_order_relaxed);
+						slot.exceptions.store(0, std::memory_order_relaxed);
+						slot.suspends.store(0, std::memory_order_relaxed);
+						slot.total_ns.store(0, std::memory_order_relaxed);
+						slot.max_ns.store(0, std::memory_order_relaxed);
+						for (size_t b = 0; b < FunctionMetrics::bucket_count; ++b)
+							slot.histogram[b].store(0, std::memory_order_relaxed);
+					}
+				}
+			}
+
+		private:
+			function_slot &remember(int key, function_slot *slot)
+			{
+				_lastKey = key;
+				_lastSlot = slot;
+				return *slot;
+			}
+
+			slot_table _table;
+			int _lastKey;
+			function_slot *_lastSlot;
+		};
+
+		struct registry
+		{
+			std::mutex mutex;
+			std::vector<thread_metrics*> threads;
+			//! Metrics of threads that have exited
+			std::map<int, FunctionMetrics> retired;
+		};
+
+		static std::atomic<bool> &enabled_flag()
+		{
+			static std::atomic<bool> enabled(false);
+			return enabled;
+		}
+
+		static registry &get_registry()
+		{
+			static registry reg;
+			return reg;
+		}
+
+		static thread_metrics &local()
+		{
+			static thread_local thread_metrics metrics;
+			return metrics;
+		}
+
+		static void increment(counter &c)
+		{
+			c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		static void add(FunctionMetrics &total, const function_slot &slot)
+		{
+			total.calls += slot.calls.load(std::memory_order_relaxed);
+			total.exceptions += slot.exceptions.load(std::memory_order_relaxed);
+			total.suspends += slot.suspends.load(std::memory_order_relaxed);
+			total.total_ns += slot.total_ns.load(std::memory_order_relaxed);
+			std::uint64_t max = slot.max_ns.load(std::memory_order_relaxed);
+			if (max > total.max_ns)
+				total.max_ns = max;
+			for (size_t i = 0; i < FunctionMetrics::bucket_count; ++i)
+				total.histogram[i] += slot.histogram[i].load(std::memory_order_relaxed);
+		}
+
+		static void add(FunctionMetrics &total, const FunctionMetrics &other)
+		{
+			total.calls += other.calls;
+			total.exceptions += other.exceptions;
+			total.suspends += other.suspends;
+			total.total_ns += other.total_ns;
+			if (other.max_ns > total.max_ns)
+				total.max_ns = other.max_ns;
+			for (size_t i = 0; i < FunctionMetrics::bucket_count; ++i)
+				total.histogram[i] += other.histogram[i];
+		}
+
+		static std::string function_name(asIScriptEngine *engine, int function_id)
+		{
+			asIScriptFunction *function = engine != nullptr ? engine->GetFunctionById(function_id) : nullptr;
+			if (function != nullptr)
+				return function->GetDeclaration();
+			return "#" + std::to_string(function_id);
+		}
+
+		static std::string json_escape(const std::string &text)
+		{
+			std::string escaped;
+			escaped.reserve(text.size());
+			for (auto it = text.begin(), end = text.end(); it != end; ++it)
+			{
+				if (*it == '"' || *it == '\\')
+					escaped += '\\';
+				escaped += *it;
+			}
+			return escaped;
+		}
+	};
+
+}}
+
+#endif
@@ -13,9 +13,17 @@
 
 #include "../Exception.h"
 #include "CallerBase.h"
+#include "ScriptError.h"
+#include "TypedCaller.h"
 
 #include <boost/preprocessor.hpp>
 
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 //! Maximum number of templated parameters for Caller::operator()
 #define SCRIPTCALL_NUMPARAMS 16
 
@@ -64,6 +72,137 @@ namespace ScriptUtils { namespace Calling
 		}
 	}
 
+	//! What Caller#call_batch() does when one of the calls fails
+	enum BatchErrorMode
+	{
+		//! Stop at the first failed call
+		StopOnError,
+		//! Record the failure and carry on with the next item
+		ContinueOnError
+	};
+
+	//! Describes a call in a batch that didn't finish
+	struct BatchError
+	{
+		//! Index of the item (in the argument range) that failed
+		size_t index;
+		//! The value returned by asIScriptContext::Execute() (e.g. asEXECUTION_EXCEPTION)
+		int result;
+		//! The script exception string, if the call failed because of a script exception
+		std::string message;
+
+		BatchError(size_t index_, int result_, const std::string &message_)
+			: index(index_), result(result_), message(message_)
+		{}
+	};
+
+	//! The outcome of Caller#call_batch()
+	struct BatchResult
+	{
+		//! Number of calls that finished (and wrote a result)
+		size_t completed;
+		//! The calls that didn't finish, in order
+		std::vector<BatchError> errors;
+
+		BatchResult()
+			: completed(0)
+		{}
+
+		bool ok() const { return errors.empty(); }
+	};
+
+	//! Sets the args for a call from a tuple (used by Caller#call_batch())
+	template <size_t N>
+	struct TupleArgSetter
+	{
+		template <class Tuple>
+		static void set(CallerBase &caller, const Tuple &args)
+		{
+			TupleArgSetter<N-1>::set(caller, args);
+			checkSetArgReturn(caller.set_arg(N-1, std::get<N-1>(args)), N-1, std::get<N-1>(args));
+		}
+	};
+
+	template <>
+	struct TupleArgSetter<0>
+	{
+		template <class Tuple>
+		static void set(CallerBase &, const Tuple &)
+		{}
+	};
+
+	//! Converts a Caller's return value to R
+	/*!
+	* Primitives, pointers and references are read straight from the return
+	* slot. Class types (e.g. strings) are moved out of the object the context
+	* holds - or copied, if the script returned a reference - and handles can
+	* be returned as (owning) ScriptHandle objects.
+	*/
+	template <typename R, typename Enable = void>
+	struct CallerReturn
+	{
+		static R get(asIScriptContext *ctx, int, asDWORD)
+		{
+			return static_cast< CallHelper<R>* >(ctx->GetAddressOfReturnValue())->element;
+		}
+	};
+
+	template <typename R>
+	struct CallerReturn<R, typename std::enable_if<std::is_class<R>::value>::type>
+	{
+		static R get(asIScriptContext *ctx, int typeId, asDWORD flags)
+		{
+			if (is_object_typeid(typeId) || (typeId & asTYPEID_OBJHANDLE))
+				return ScriptReturnTraits<R>::get(ctx, typeId, flags);
+			return take_return_value(static_cast<R*>(ctx->GetAddressOfReturnValue()), flags);
+		}
+	};
+
+	template <>
+	struct CallerReturn<void>
+	{
+		static void get(asIScriptContext *, int, asDWORD) {}
+	};
+
+	//! Checks that a Caller's return value can be converted to R
+	/*!
+	* Only ScriptHandle returns are checked: a value type isn't reference
+	* counted, so a handle to it would free the object the context owns.
+	*/
+	template <typename R>
+	struct CallerReturnCheck
+	{
+		static bool accepts(asIScriptEngine *, int, asDWORD) { return true; }
+	};
+
+	template <typename T>
+	struct CallerReturnCheck<ScriptHandle<T>>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags)
+		{
+			return ScriptReturnTraits<ScriptHandle<T>>::accepts(engine, typeId, flags);
+		}
+	};
+
+	//! Reads a Caller's return value into an Expected (see Caller#try_call())
+	template <typename R>
+	struct CallerExpectedReturn
+	{
+		static Expected<R> get(asIScriptContext *ctx, int typeId, asDWORD flags)
+		{
+			return Expected<R>(CallerReturn<R>::get(ctx, typeId, flags));
+		}
+	};
+
+	template <>
+	struct CallerExpectedReturn<void>
+	{
+		static Expected<void> get(asIScriptContext *, int, asDWORD)
+		{
+			return Expected<void>();
+		}
+	};
+
 	//! Creates a callable object (with templated parameters) for an AngelScript function
 	/*!
 	* Based on code by SiCrane from gamedev.net, see:
@@ -99,12 +238,22 @@ namespace ScriptUtils { namespace Calling
 			: CallerBase(context, function)
 		{}
 
+		//! Constructor for object methods - borrows a context from the engine's ContextPool
+		Caller(asIScriptEngine *engine, asIScriptObject *obj, asIScriptFunction* function)
+			: CallerBase(engine, obj, function)
+		{}
+
+		//! Constructor - borrows a context from the engine's ContextPool
+		Caller(asIScriptEngine *engine, asIScriptFunction* function)
+			: CallerBase(engine, function)
+		{}
+
 		//! Creates a caller for a global method
 		static Caller Create(asIScriptEngine *engine, const std::string& method_decl)
 		{
 			auto function = engine->GetGlobalFunctionByDecl(method_decl.c_str());
 
-			return Caller(engine->CreateContext(), function);
+			return Caller(engine, function);
 		}
 
 		//! Creates a caller for a global method
@@ -112,7 +261,7 @@ namespace ScriptUtils { namespace Calling
 		{
 			auto function = module->GetFunctionByDecl(method_decl.c_str());
 
-			return Caller(module->GetEngine()->CreateContext(), function);
+			return Caller(module->GetEngine(), function);
 		}
 
 		//! Creates a caller for an object method
@@ -121,7 +270,7 @@ namespace ScriptUtils { namespace Calling
 			auto type = object->GetObjectType();
 			auto method = type->GetMethodByDecl(method_decl.c_str());
 
-			return Caller(type->GetEngine()->CreateContext(), object, method);
+			return Caller(type->GetEngine(), object, method);
 		}
 
 		//! Creates a caller for an object method
@@ -136,30 +285,25 @@ namespace ScriptUtils { namespace Calling
 		//! Creates a caller for a factory fn.
 		static Caller FactoryCaller(asIObjectType *type, const std::string &params)
 		{
-			return FactoryCaller(type->GetEngine()->CreateContext(), type, params);
+			return Caller(type->GetEngine(), get_factory(type, params));
 		}
 
 		//! Creates a caller for a factory fn.
 		static Caller FactoryCaller(asIScriptContext* ctx, asIObjectType *type, const std::string &params)
 		{
-			std::string type_name(type->GetName());
-			auto factory = type->GetFactoryByDecl((type_name+"@ "+type_name+"("+params+")").c_str());
-
-			return Caller(ctx, factory);
+			return Caller(ctx, get_factory(type, params));
 		}
 
 		//! Creates a caller for a global fn. for which the ID is known
 		static Caller CallerForGlobalFuncId(asIScriptEngine *engine, int funcId)
 		{
-			return Caller(engine->CreateContext(), engine->GetFunctionById(funcId));
+			return Caller(engine, engine->GetFunctionById(funcId));
 		}
 
 		//! Creates a object method for which the ID is known
 		static Caller CallerForMethodFuncId(asIScriptObject *obj, int funcId)
 		{
-			Caller caller(obj->GetEngine()->CreateContext(), obj->GetEngine()->GetFunctionById(funcId));
-			caller.set_object(obj);
-			return caller;
+			return Caller(obj->GetEngine(), obj, obj->GetEngine()->GetFunctionById(funcId));
 		}
 
 		Caller& operator =(const Caller &other)
@@ -183,8 +327,9 @@ namespace ScriptUtils { namespace Calling
 		/*!
 		* \tparam R
 		* The return type. There is no conversion function - stored data
-		* must be compatible (i.e. (R)ctx->GetReturnAddress() must be
-		* possible).
+		* must be compatible (see CallerReturn). Objects returned by value
+		* are moved out of the context (returned references are copied); use
+		* ScriptHandle<T> to keep a reference to a returned handle.
 		*
 		* \todo ?ConversionException for return conversion errors - if conversion checking / callbacks are implimented
 		*/
@@ -193,7 +338,21 @@ namespace ScriptUtils { namespace Calling
 		{
 			refresh();
 			execute();
-			return static_cast< CallHelper<R>* >(return_address())->element;
+			return get_return<R>();
+		}
+
+		//! Calls the function with no params, without throwing
+		/*!
+		* Failures (arg errors, script exceptions, etc.) are returned as a
+		* ScriptError rather than thrown, and nothing is allocated unless the
+		* error's message is asked for. R may be void.
+		*/
+		template <typename R>
+		Expected<R> try_call(void)
+		{
+			if (!refresh())
+				return ScriptError(ScriptError::NotPrepared, asCONTEXT_NOT_PREPARED, get_func());
+			return try_execute_and_return<R>();
 		}
 
 		//! Function-style call
@@ -210,12 +369,152 @@ namespace ScriptUtils { namespace Calling
 			return return_address();
 		}
 
+		//! Calls the function once for each tuple of arguments in [first, last)
+		/*!
+		* The context is checked once up-front and re-prepared in place for each
+		* item, rather than going through refresh() / execute() for every call.
+		* Each item is still executed with try_execute(), so CallMetrics are
+		* recorded and any arg copies are released as soon as it returns.
+		* <p>
+		* Argument errors (wrong number or type of args) apply to every item, so they
+		* throw as they do for call(). Calls that don't finish (script exceptions,
+		* suspends, etc.) are listed in the returned BatchResult; the matching
+		* results[] entries are left untouched.
+		* </p>
+		*
+		* \code
+		* std::vector<std::tuple<int, float>> args = ...;
+		* std::vector<int> results(args.size());
+		* BatchResult r = caller.call_batch(args.begin(), args.end(), results.data(), ContinueOnError);
+		* \endcode
+		*
+		* \param[in] first, last
+		* Range of std::tuple (or std::pair) objects, each holding the args for one call.
+		*
+		* \param[out] results
+		* Contiguous buffer with room for one R per item.
+		*
+		* \param[in] mode
+		* Whether to stop at the first failed call.
+		*/
+		template <typename R, typename InputIt>
+		BatchResult call_batch(InputIt first, InputIt last, R *results, BatchErrorMode mode = StopOnError)
+		{
+			return run_batch(first, last, results, mode);
+		}
+
+		//! Calls a function that returns void once for each tuple of arguments in [first, last)
+		/*!
+		* \see call_batch(InputIt, InputIt, R*, BatchErrorMode)
+		*/
+		template <typename InputIt>
+		BatchResult call_batch(InputIt first, InputIt last, BatchErrorMode mode = StopOnError)
+		{
+			return run_batch(first, last, static_cast<void*>(nullptr), mode);
+		}
+
 #define repeat_set_arg(z, n, text) checkSetArgReturn(set_arg(n, a ## n), n, a##n);
+#define repeat_try_set_arg(z, n, text) if (int r = set_arg(n, a ## n)) return ScriptError::FromSetArgResult(r, n, get_func());
 
 #define BOOST_PP_ITERATION_PARAMS_1 (3, (1, SCRIPTCALL_NUMPARAMS, "ScriptUtils/Calling/Caller.h"))
 #include BOOST_PP_ITERATE()
 
 #undef repeat_set_arg
+#undef repeat_try_set_arg
+
+	private:
+		template <typename R>
+		Expected<R> try_execute_and_return()
+		{
+			int r = try_execute();
+			if (r != asEXECUTION_FINISHED)
+				return ScriptError::FromExecuteResult(r, get_func(), get_ctx());
+
+			asDWORD flags = 0;
+			int typeId = get_func()->GetReturnTypeId(&flags);
+			if (!CallerReturnCheck<R>::accepts(get_ctx()->GetEngine(), typeId, flags))
+				return ScriptError(ScriptError::ExecutionFailed, asINVALID_TYPE, get_func());
+			return CallerExpectedReturn<R>::get(get_ctx(), typeId, flags);
+		}
+
+		template <typename R>
+		R get_return()
+		{
+			asDWORD flags = 0;
+			int typeId = get_func()->GetReturnTypeId(&flags);
+			if (!CallerReturnCheck<R>::accepts(get_ctx()->GetEngine(), typeId, flags))
+				throw Exception("Caller: the return value of " + get_declaration() + " isn't a reference type, so it can't be held by a ScriptHandle");
+			return CallerReturn<R>::get(get_ctx(), typeId, flags);
+		}
+
+		template <typename R>
+		void store_result(R *results, size_t index)
+		{
+			results[index] = get_return<R>();
+		}
+
+		void store_result(void *, size_t)
+		{
+		}
+
+		template <typename InputIt, typename Results>
+		BatchResult run_batch(InputIt first, InputIt last, Results results, BatchErrorMode mode)
+		{
+			typedef typename std::iterator_traits<InputIt>::value_type args_type;
+
+			BatchResult batch;
+
+			asIScriptContext *ctx = get_ctx();
+			asIScriptFunction *func = get_func();
+			asIScriptObject *obj = get_object();
+			if (!is_ok() || ctx == nullptr || ctx->GetState() == asEXECUTION_ACTIVE)
+				throw Exception("Can't execute batch of " + get_declaration() + " - Caller is not prepared to execute");
+
+			for (size_t index = 0; first != last; ++first, ++index)
+			{
+				if (ctx->GetState() != asEXECUTION_PREPARED)
+				{
+					if (ctx->Prepare(func) < 0 || (obj != nullptr && ctx->SetObject(obj) < 0))
+						throw Exception("Can't execute batch of " + get_declaration() + " - failed to prepare the context");
+				}
+
+				TupleArgSetter<std::tuple_size<args_type>::value>::set(*this, *first);
+
+				// Records CallMetrics, and releases the arg copies made for this item
+				int r = try_execute();
+				if (r == asEXECUTION_FINISHED)
+				{
+					store_result(results, index);
+					++batch.completed;
+				}
+				else
+				{
+					if (r == asEXECUTION_EXCEPTION)
+						batch.errors.push_back(BatchError(index, r, ctx->GetExceptionString()));
+					else
+					{
+						// Leave the context in a state that can be prepared again
+						if (r == asEXECUTION_SUSPENDED)
+						{
+							ctx->Abort();
+							arg_copies().release();
+						}
+						batch.errors.push_back(BatchError(index, r, std::string()));
+					}
+
+					if (mode == StopOnError)
+						break;
+				}
+			}
+
+			return batch;
+		}
+
+		static asIScriptFunction* get_factory(asIObjectType *type, const std::string &params)
+		{
+			std::string type_name(type->GetName());
+			return type->GetFactoryByDecl((type_name+"@ "+type_name+"("+params+")").c_str());
+		}
 	};
 
 }} // namespace
@@ -227,7 +526,7 @@ namespace ScriptUtils { namespace Calling
 #define n BOOST_PP_ITERATION()
 
 		template <typename R, BOOST_PP_ENUM_PARAMS_Z(1 ,n, typename A)>
-		R call(BOOST_PP_ENUM_BINARY_PARAMS_Z(1, n, A ,a))
+		R call(BOOST_PP_ENUM_BINARY_PARAMS_Z(1, n, const A, &a))
 		{
 			// Prepare the asIScriptContext (does nothing if it is already prepared)
 			refresh();
@@ -237,11 +536,22 @@ namespace ScriptUtils { namespace Calling
 
 			execute();
 
-			return static_cast< CallHelper<R>* >(return_address())->element;
+			return get_return<R>();
+		}
+
+		template <typename R, BOOST_PP_ENUM_PARAMS_Z(1 ,n, typename A)>
+		Expected<R> try_call(BOOST_PP_ENUM_BINARY_PARAMS_Z(1, n, const A, &a))
+		{
+			if (!refresh())
+				return ScriptError(ScriptError::NotPrepared, asCONTEXT_NOT_PREPARED, get_func());
+			// Returns a ScriptError if set_arg(n, an) fails for any 'n'
+			BOOST_PP_REPEAT(n, repeat_try_set_arg, ~)
+
+			return try_execute_and_return<R>();
 		}
 
 		template <BOOST_PP_ENUM_PARAMS_Z(1 ,n, typename A)>
-		void* operator() (BOOST_PP_ENUM_BINARY_PARAMS_Z(1, n, A ,a))
+		void* operator() (BOOST_PP_ENUM_BINARY_PARAMS_Z(1, n, const A, &a))
 		{
 			// Prepare the asIScriptContext (does nothing if it is already prepared)
 			refresh();
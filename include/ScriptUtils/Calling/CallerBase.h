@@ -10,11 +10,18 @@
 #include <angelscript.h>
 
 #include "../Exception.h"
+#include "ArgMarshalling.h"
+#include "CallMetrics.h"
+#include "ContextPool.h"
+#include "ScriptCallbacks.h"
 
+#ifdef SCRIPTUTILS_USE_SIGNALS2
 #include <boost/signals2/signal.hpp>
+#endif
 #include <boost/function.hpp>
 #include <memory>
 #include <sstream>
+#include <type_traits>
 
 
 namespace ScriptUtils { namespace Calling
@@ -49,14 +56,14 @@ namespace ScriptUtils { namespace Calling
 		*/
 		CallerBase()
 			: ctx(nullptr), obj(nullptr), func(nullptr), ok(false),
-			throwOnException(false)
+			pooled(false), throwOnException(false)
 		{
 		}
 
 		//! Constructor for class methods
 		CallerBase(asIScriptContext *context, asIScriptObject* object, asIScriptFunction* function)
 			: ctx(context), obj(object), func(function), ok(false),
-			throwOnException(false)
+			pooled(false), throwOnException(false)
 		{
 			if (ctx != nullptr)
 			{
@@ -75,7 +82,7 @@ namespace ScriptUtils { namespace Calling
 		//! Constructor for global methods
 		CallerBase(asIScriptContext *context, asIScriptFunction* function)
 			: ctx(context), obj(nullptr), func(function), ok(false),
-			throwOnException(false)
+			pooled(false), throwOnException(false)
 		{
 			if (ctx != nullptr)
 			{
@@ -90,29 +97,37 @@ namespace ScriptUtils { namespace Calling
 			}
 		}
 
+		//! Constructor for class methods, using a context borrowed from the engine's ContextPool
+		CallerBase(asIScriptEngine *engine, asIScriptObject* object, asIScriptFunction* function)
+			: ctx(nullptr), obj(object), func(function), ok(false),
+			pooled(false), throwOnException(false)
+		{
+			if (func != nullptr)
+				acquire_context(engine);
+		}
+
+		//! Constructor for global methods, using a context borrowed from the engine's ContextPool
+		CallerBase(asIScriptEngine *engine, asIScriptFunction* function)
+			: ctx(nullptr), obj(nullptr), func(function), ok(false),
+			pooled(false), throwOnException(false)
+		{
+			if (func != nullptr)
+				acquire_context(engine);
+		}
+
 		//! Copy constructor
 		CallerBase(const CallerBase &other)
-			: ctx(other.ctx),
+			: ctx(nullptr),
 			obj(other.obj),
 			func(other.func),
-			ok(other.ok),
+			ok(false),
+			pooled(false),
 			throwOnException(other.throwOnException),
 			LineSignal(other.LineSignal),
 			ScriptExceptionSignal(other.ScriptExceptionSignal)
 		{
 			if (other.is_ok())
-			{
-				ctx = other.ctx->GetEngine()->CreateContext();
-
-				if (ctx == nullptr)
-					ok = false;
-				else
-				{
-					check_asreturn(ctx->Prepare(func));
-					if (obj != nullptr)
-						check_asreturn(ctx->SetObject(obj));
-				}
-			}
+				acquire_context(other.ctx->GetEngine());
 		}
 
 		//! Move constructor
@@ -121,6 +136,7 @@ namespace ScriptUtils { namespace Calling
 			obj(other.obj),
 			func(other.func),
 			ok(other.ok),
+			pooled(other.pooled),
 			throwOnException(other.throwOnException),
 			LineSignal(std::move(other.LineSignal)),
 			ScriptExceptionSignal(std::move(other.ScriptExceptionSignal))
@@ -128,6 +144,10 @@ namespace ScriptUtils { namespace Calling
 			other.ctx = nullptr;
 			other.obj = nullptr;
 			other.func = nullptr;
+			other.ok = false;
+			other.pooled = false;
+			// A suspended context may still refer to them
+			argCopies.swap(other.argCopies);
 		}
 
 		//! Destructor
@@ -139,6 +159,9 @@ namespace ScriptUtils { namespace Calling
 		//! Copy-assignment operator
 		CallerBase& operator= (const CallerBase &other)
 		{
+			if (this == &other)
+				return *this;
+
 			// Release this object's reference to the context & script object;
 			//  ctx is about to be copied from the other caller
 			release();
@@ -146,26 +169,13 @@ namespace ScriptUtils { namespace Calling
 			obj = other.obj;
 			func = other.func;
 
-			ok = other.ok;
-
-			if (other.is_ok())
-			{
-				ctx = other.ctx->GetEngine()->CreateContext();
-
-				if (ctx)
-				{
-					check_asreturn(ctx->Prepare(func));
-					if (obj)
-						check_asreturn(ctx->SetObject(obj));
-				}
-				else
-					ok = false;
-			}
-
-			// Signal ptrs
+			// Signal ptrs (copied before acquiring a context so that the callbacks get connected to it)
 			LineSignal = other.LineSignal;
 			ScriptExceptionSignal = other.ScriptExceptionSignal;
 
+			if (other.is_ok())
+				acquire_context(other.ctx->GetEngine());
+
 			throwOnException = other.throwOnException;
 
 			return *this;
@@ -180,11 +190,15 @@ namespace ScriptUtils { namespace Calling
 			// Swap the uninit-ed ctx & obj with those of the other caller
 			std::swap(ctx, other.ctx);
 			std::swap(obj, other.obj);
+			std::swap(pooled, other.pooled);
 
 			func = other.func;
 			other.func = nullptr;
 
 			ok = other.ok;
+			other.ok = false;
+
+			argCopies.swap(other.argCopies);
 
 			// Signal ptrs
 			LineSignal = std::move(other.LineSignal);
@@ -196,25 +210,39 @@ namespace ScriptUtils { namespace Calling
 		}
 
 		//! Releases the internal asIScriptContext
+		/*!
+		* Contexts borrowed from a ContextPool are given back to it.
+		*/
 		void release()
 		{
 			if (ctx != nullptr)
 			{
-				bool heldObject = false;
-				if (ctx->GetState() == asEXECUTION_PREPARED && obj != nullptr)
+				argCopies.release();
+
+				if (pooled)
 				{
-					// Temporarily remove the object from the ctx to prevent an error that seems to happen if a ctx is deallocated with a held object
-					ctx->SetObject(nullptr);
-					heldObject = true;
+					// The pool unprepares the context, which releases the held object properly
+					ReturnContext(ctx);
 				}
-				if (ctx->Release() > 0 && heldObject)
+				else
 				{
-					// If this caller wasn't the last reference to the ctx, restore the object 
-					ctx->SetObject(obj);
+					bool heldObject = false;
+					if (ctx->GetState() == asEXECUTION_PREPARED && obj != nullptr)
+					{
+						// Temporarily remove the object from the ctx to prevent an error that seems to happen if a ctx is deallocated with a held object
+						ctx->SetObject(nullptr);
+						heldObject = true;
+					}
+					if (ctx->Release() > 0 && heldObject)
+					{
+						// If this caller wasn't the last reference to the ctx, restore the object 
+						ctx->SetObject(obj);
+					}
 				}
 				ctx = nullptr;
 				obj = nullptr;
 				ok = false;
+				pooled = false;
 			}
 		}
 
@@ -224,23 +252,46 @@ namespace ScriptUtils { namespace Calling
 			return ok;
 		}
 
+		//! Makes sure the context is prepared to execute
+		/*!
+		* A context that has finished executing (or was aborted / threw) is
+		* re-prepared in place, which doesn't allocate: AngelScript skips most
+		* of the setup when the same function is prepared again, so the context
+		* isn't unprepared first. Only a context that is still in use - active
+		* (e.g. this caller is being called recursively) or suspended - is
+		* swapped for another one from the engine's ContextPool.
+		*/
 		bool refresh()
 		{
-			if (ctx != nullptr && ctx->GetState() != asEXECUTION_PREPARED)
+			if (ctx == nullptr || func == nullptr)
+				return is_ok();
+
+			asEContextState state = ctx->GetState();
+			if (state == asEXECUTION_PREPARED)
+				return is_ok();
+
+			// The context is done with (or is giving up) the args of the last call
+			argCopies.release();
+
+			if (state == asEXECUTION_ACTIVE || state == asEXECUTION_SUSPENDED)
 			{
 				asIScriptEngine *engine = ctx->GetEngine();
-				ctx->Release();
-				ctx = engine->CreateContext();
-
-				if (ctx == nullptr)
-				{
-					ok = false;
-					return false;
-				}
+				if (pooled)
+					ReturnContext(ctx);
+				else
+					ctx->Release();
+				ctx = nullptr;
 
+				acquire_context(engine);
+			}
+			else
+			{
+				ok = true;
 				check_asreturn( ctx->Prepare(func) );
 				if (obj != nullptr)
 					check_asreturn( ctx->SetObject(obj) );
+				// In case slots were connected (via a caller sharing the signal) after it was cleared
+				attach_line_callback();
 			}
 			return is_ok();
 		}
@@ -255,6 +306,12 @@ namespace ScriptUtils { namespace Calling
 			return func;
 		}
 
+		//! Returns the object methods are called on (nullptr for global functions)
+		asIScriptObject* get_object() const
+		{
+			return obj;
+		}
+
 		//! Sets the object for this caller (if it wasn't set before, or needs to be changed)
 		bool set_object(asIScriptObject *_obj)
 		{
@@ -263,7 +320,7 @@ namespace ScriptUtils { namespace Calling
 			obj = _obj;
 			//if (obj != nullptr)
 			//	obj->AddRef();
-			if (ctx->GetState() & asEXECUTION_PREPARED)
+			if (ctx != nullptr && ctx->GetState() == asEXECUTION_PREPARED)
 			{
 				return check_asreturn( ctx->SetObject(obj) );
 			}
@@ -277,41 +334,68 @@ namespace ScriptUtils { namespace Calling
 			throwOnException = should_throw;
 		}
 
+		//! Returns the state of the context (asEXECUTION_UNINITIALIZED if there is none)
 		asEContextState GetState() const
 		{
+			if (ctx == nullptr)
+				return asEXECUTION_UNINITIALIZED;
 			return ctx->GetState();
 		}
 
 		typedef boost::function<void (asIScriptContext*)> script_callback_fn;
 
+#ifdef SCRIPTUTILS_USE_SIGNALS2
 		typedef boost::signals2::signal<void (asIScriptContext*)> line_signal;
 		typedef boost::signals2::signal<void (asIScriptContext*)> exception_signal;
 
+		typedef boost::signals2::connection callback_connection;
+#else
+		typedef ScriptCallbackList line_signal;
+		typedef ScriptCallbackList exception_signal;
+
+		typedef ScriptCallbackConnection callback_connection;
+#endif
+
 		typedef std::shared_ptr<line_signal> line_signal_ptr;
 		typedef std::shared_ptr<exception_signal> exception_signal_ptr;
 
 		//! Connects a line callback slot
-		boost::signals2::connection ConnectLineCallback(script_callback_fn fn)
+		/*!
+		* The context's line callback is only set while something is connected
+		* (it's cleared once the last slot is disconnected), so unused hooks cost
+		* nothing. By default the slots are kept in a ScriptCallbackList; define
+		* SCRIPTUTILS_USE_SIGNALS2 to use a boost::signals2::signal instead (much
+		* slower to dispatch per line).
+		*/
+		callback_connection ConnectLineCallback(script_callback_fn fn)
 		{
-			if (!LineSignal)
-			{
-				LineSignal = std::make_shared<line_signal>();
-				ctx->SetLineCallback(asFUNCTION(CallerLineCallback), LineSignal.get(), asCALL_CDECL);
-			}
-			return LineSignal->connect(fn);
+			callback_connection connection = line_callbacks().connect(fn);
+			attach_line_callback();
+			return connection;
 		}
 
 		//! Connects an exception callback
-		boost::signals2::connection ConnectExceptionCallback(script_callback_fn fn)
+		callback_connection ConnectExceptionCallback(script_callback_fn fn)
 		{
-			if (!ScriptExceptionSignal)
-			{
-				ScriptExceptionSignal = std::make_shared<exception_signal>();
-				ctx->SetExceptionCallback(asFUNCTION(CallerExceptionCallback), ScriptExceptionSignal.get(), asCALL_CDECL);
-			}
-			return ScriptExceptionSignal->connect(fn);
+			return exception_callbacks().connect(fn);
 		}
 
+#ifndef SCRIPTUTILS_USE_SIGNALS2
+		//! Connects a plain function as a line callback, called as fn(ctx, data)
+		callback_connection ConnectLineCallback(ScriptCallbackList::callback_fn fn, void *data)
+		{
+			callback_connection connection = line_callbacks().connect(fn, data);
+			attach_line_callback();
+			return connection;
+		}
+
+		//! Connects a plain function as an exception callback, called as fn(ctx, data)
+		callback_connection ConnectExceptionCallback(ScriptCallbackList::callback_fn fn, void *data)
+		{
+			return exception_callbacks().connect(fn, data);
+		}
+#endif
+
 		//! Returns the script context used by this Caller
 		asIScriptContext* get_ctx() const
 		{
@@ -321,10 +405,31 @@ namespace ScriptUtils { namespace Calling
 		//! Sets the given arg
 		/*!
 		* Use when args need to be set iteratively - otherwise use Caller#operator().
+		* <p>
+		* Objects are passed according to the param (see object_arg_mode()):
+		* by address for const &in params, so t must outlive the call; a copy
+		* is only made for by-value and non-const &in params. Since t is const,
+		* it can't be given to &out or &inout params (asINVALID_TYPE is
+		* returned) - pass a pointer to the object that receives the output.
+		* </p>
 		*/
 		template <typename T>
-		int set_arg(asUINT arg, T t)
+		int set_arg(asUINT arg, const T &t)
 		{
+			asDWORD flags = 0;
+			int typeId = func != nullptr ? func->GetParamTypeId(arg, &flags) : asINVALID_ARG;
+			if (typeId < 0)
+				return asINVALID_ARG;
+			if (ctx == nullptr)
+				return asCONTEXT_NOT_PREPARED;
+
+			if (std::is_class<T>::value && is_object_typeid(typeId))
+			{
+				if (is_writable_ref(flags))
+					return asINVALID_TYPE;
+				return set_object_arg(ctx, arg, &t, typeId, object_arg_mode(typeId, flags), argCopies);
+			}
+
 			if (ctx->GetAddressOfArg(arg) != nullptr)
 			{
 				new (ctx->GetAddressOfArg(arg)) CallHelper<T>(t);
@@ -334,26 +439,48 @@ namespace ScriptUtils { namespace Calling
 				return asINVALID_ARG;
 		}
 
+		//! Sets a pointer arg
+		/*!
+		* Handles (and objects passed by value) are set with SetArgObject(), so
+		* a handle gets the reference the script releases when it returns;
+		* references are set to the address.
+		*/
 		template <typename T>
 		int set_arg(asUINT arg, T* t)
 		{
+			if (ctx == nullptr)
+				return asCONTEXT_NOT_PREPARED;
+			asDWORD flags = 0;
+			int typeId = func != nullptr ? func->GetParamTypeId(arg, &flags) : asINVALID_ARG;
+			if (typeId < 0)
+				return asINVALID_ARG;
+			if (is_object_typeid(typeId) && (flags & asTM_INOUTREF) == 0)
+				return ctx->SetArgObject(arg, (void*)t);
 			return ctx->SetArgAddress(arg, (void*)t);
 		}
 
 		int set_arg(asUINT arg, asDWORD t)
 		{
+			if (ctx == nullptr)
+				return asCONTEXT_NOT_PREPARED;
 			return ctx->SetArgDWord(arg, t);
 		}
 		int set_arg(asUINT arg, asQWORD t)
 		{
+			if (ctx == nullptr)
+				return asCONTEXT_NOT_PREPARED;
 			return ctx->SetArgQWord(arg, t);
 		}
 		int set_arg(asUINT arg, float t)
 		{
+			if (ctx == nullptr)
+				return asCONTEXT_NOT_PREPARED;
 			return ctx->SetArgFloat(arg, t);
 		}
 		int set_arg(asUINT arg, double t)
 		{
+			if (ctx == nullptr)
+				return asCONTEXT_NOT_PREPARED;
 			return ctx->SetArgDouble(arg, t);
 		}
 
@@ -365,6 +492,35 @@ namespace ScriptUtils { namespace Calling
 		exception_signal_ptr ScriptExceptionSignal;
 		//script_exception_callback_fn OnScriptException;
 
+		line_signal &line_callbacks()
+		{
+			if (!LineSignal)
+				LineSignal = std::make_shared<line_signal>();
+			return *LineSignal;
+		}
+
+		//! Sets the context's line callback if any slots are connected
+		/*!
+		* CallerLineCallback() clears it again once they've all been disconnected.
+		* Without a ctx the callback is set when one is acquired (see acquire_context()).
+		*/
+		void attach_line_callback()
+		{
+			if (ctx != nullptr && LineSignal && !LineSignal->empty())
+				ctx->SetLineCallback(asFUNCTION(CallerLineCallback), LineSignal.get(), asCALL_CDECL);
+		}
+
+		exception_signal &exception_callbacks()
+		{
+			if (!ScriptExceptionSignal)
+			{
+				ScriptExceptionSignal = std::make_shared<exception_signal>();
+				if (ctx != nullptr)
+					ctx->SetExceptionCallback(asFUNCTION(CallerExceptionCallback), ScriptExceptionSignal.get(), asCALL_CDECL);
+			}
+			return *ScriptExceptionSignal;
+		}
+
 		std::string get_declaration() const
 		{
 			return func ? func->GetDeclaration() : "invalid function object";
@@ -380,7 +536,7 @@ namespace ScriptUtils { namespace Calling
 			if (!ok)
 				throw Exception("Can't execute " + get_declaration() + " - Caller is not valid");
 
-			int r = ctx->Execute();
+			int r = run_context();
 			if (r < 0)
 				throw Exception("Error while executing " + get_declaration());
 			
@@ -391,9 +547,28 @@ namespace ScriptUtils { namespace Calling
 			}
 		}
 
+		//! Executes the script method without throwing
+		/*!
+		* \returns
+		* The result of asIScriptContext#Execute(), or asCONTEXT_NOT_PREPARED if
+		* the caller isn't prepared to execute
+		*/
+		int try_execute()
+		{
+			if (!ok || ctx == nullptr || ctx->GetState() != asEXECUTION_PREPARED)
+				return asCONTEXT_NOT_PREPARED;
+			return run_context();
+		}
+
 		void* return_address()
 		{
-			return ctx->GetAddressOfReturnValue();
+			return ctx != nullptr ? ctx->GetAddressOfReturnValue() : nullptr;
+		}
+
+		//! Holds copies of args made for the current call (see set_object_arg())
+		ArgCopies &arg_copies()
+		{
+			return argCopies;
 		}
 
 		// Sets ok to false if the result of an AngelScript fn. indicates an error
@@ -405,19 +580,57 @@ namespace ScriptUtils { namespace Calling
 		}
 
 	private:
+		//! Executes ctx, recording CallMetrics if they're enabled
+		int run_context()
+		{
+			int r = CallMetrics::Execute(ctx, func);
+			// A suspended context still refers to its args
+			if (r != asEXECUTION_SUSPENDED)
+				argCopies.release();
+			return r;
+		}
+
+		//! Borrows a context (see AcquireContext()) and prepares it for func / obj
+		void acquire_context(asIScriptEngine *engine)
+		{
+			ctx = AcquireContext(engine);
+			pooled = ctx != nullptr;
+			ok = pooled;
+			if (ok)
+			{
+				check_asreturn(ctx->Prepare(func));
+				if (obj != nullptr)
+					check_asreturn(ctx->SetObject(obj));
+
+				// Reconnect the callbacks (the signals may be shared with the caller this was copied from)
+				attach_line_callback();
+				if (ScriptExceptionSignal)
+					ctx->SetExceptionCallback(asFUNCTION(CallerExceptionCallback), ScriptExceptionSignal.get(), asCALL_CDECL);
+			}
+		}
+
 		asIScriptContext* ctx;
 		asIScriptObject* obj;
 		asIScriptFunction* func;
 
 		bool ok;
 
+		//! True if ctx was gotten from AcquireContext() (rather than passed in)
+		bool pooled;
+
 		bool throwOnException;
+
+		//! Copies made by set_arg() for the current call
+		ArgCopies argCopies;
 	};
 
 	static void CallerLineCallback(asIScriptContext *ctx, void *obj)
 	{
 		CallerBase::line_signal *sig = static_cast<CallerBase::line_signal*>( obj );
 		(*sig)(ctx);
+		// Stop calling back once the last slot has been disconnected
+		if (sig->empty())
+			ctx->ClearLineCallback();
 	}
 
 	static void CallerExceptionCallback(asIScriptContext *ctx, void *obj)
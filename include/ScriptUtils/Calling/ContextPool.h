@@ -0,0 +1,330 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_CONTEXTPOOL
+#define H_SCRIPTUTILS_CONTEXTPOOL
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Keeps idle script contexts around so that Callers don't have to create new ones
+	/*!
+	* While a ContextPool exists for an engine, every Caller created for that
+	* engine borrows its context from the pool (see AcquireContext()) and gives
+	* it back when the Caller is released. Without a pool Callers create and
+	* release contexts themselves, as before.
+	* <p>
+	* The pool is filled up to the low watermark when it is constructed, and never
+	* holds more than the high watermark of idle contexts - contexts returned
+	* while the pool is full are released.
+	* </p>
+	*
+	* \code
+	* ContextPool pool(engine, 8, 128);
+	* Caller caller = Caller::Create(module, "void Update(float)"); // borrows from pool
+	* \endcode
+	*/
+	class ContextPool
+	{
+	public:
+		//! Usage counters
+		struct Stats
+		{
+			//! Contexts handed out from the idle list
+			unsigned int hits;
+			//! Contexts that had to be created because the idle list was empty
+			unsigned int misses;
+			//! Contexts released because the idle list was at the high watermark
+			unsigned int discarded;
+			//! Contexts currently borrowed from the pool
+			unsigned int in_use;
+			//! Highest value in_use has reached
+			unsigned int peak_in_use;
+			//! Contexts currently in the idle list
+			unsigned int idle;
+
+			Stats()
+				: hits(0), misses(0), discarded(0), in_use(0), peak_in_use(0), idle(0)
+			{}
+		};
+
+	public:
+		//! Constructor
+		/*!
+		* Registers this pool as the pool for the given engine - only one pool
+		* may exist per engine at a time.
+		*
+		* \param[in] engine
+		* The engine to create contexts for.
+		*
+		* \param[in] low_watermark
+		* Number of contexts created up front, and the number Trim() leaves idle.
+		*
+		* \param[in] high_watermark
+		* Maximum number of idle contexts kept by the pool.
+		*
+		* \param[in] init_stack_size
+		* If non-zero, the initial stack size (in bytes) given to new contexts.
+		* Only supported with AngelScript versions that have asEP_INIT_STACK_SIZE.
+		*/
+		ContextPool(asIScriptEngine *engine, size_t low_watermark = 4, size_t high_watermark = 64, asUINT init_stack_size = 0)
+			: _engine(engine),
+			_lowWatermark(low_watermark),
+			_highWatermark(high_watermark < low_watermark ? low_watermark : high_watermark)
+		{
+#if ANGELSCRIPT_VERSION >= 22900
+			if (init_stack_size > 0)
+				_engine->SetEngineProperty(asEP_INIT_STACK_SIZE, init_stack_size);
+#else
+			(void)init_stack_size;
+#endif
+
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex());
+				if (!registry().insert(registry_type::value_type(_engine, this)).second)
+					throw Exception("ContextPool: the given engine already has a context pool");
+			}
+
+			_engine->AddRef();
+
+			_idle.reserve(_highWatermark);
+			for (size_t i = 0; i < _lowWatermark; ++i)
+			{
+				asIScriptContext *ctx = _engine->CreateContext();
+				if (ctx != nullptr)
+					_idle.push_back(ctx);
+			}
+			_stats.idle = _idle.size();
+		}
+
+		//! Destructor
+		/*!
+		* Releases all idle contexts. Contexts that are still borrowed are released
+		* (rather than returned) when their Callers are done with them.
+		*/
+		~ContextPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex());
+				registry().erase(_engine);
+			}
+
+			for (auto it = _idle.begin(), end = _idle.end(); it != end; ++it)
+				(*it)->Release();
+			_idle.clear();
+
+			_engine->Release();
+		}
+
+		//! Borrows a context from the pool, creating one if none are idle
+		/*!
+		* \returns
+		* An unprepared context, or nullptr if a new context couldn't be created.
+		*/
+		asIScriptContext* Acquire()
+		{
+			asIScriptContext *ctx = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_idle.empty())
+				{
+					ctx = _idle.back();
+					_idle.pop_back();
+					++_stats.hits;
+				}
+				else
+					++_stats.misses;
+
+				if (++_stats.in_use > _stats.peak_in_use)
+					_stats.peak_in_use = _stats.in_use;
+				_stats.idle = _idle.size();
+			}
+
+			if (ctx == nullptr)
+			{
+				ctx = _engine->CreateContext();
+				if (ctx == nullptr)
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					decrement_in_use();
+				}
+			}
+			return ctx;
+		}
+
+		//! Gives back a context borrowed with Acquire()
+		/*!
+		* The context is unprepared and its callbacks are removed, so the next
+		* Caller to borrow it gets a clean context.
+		*/
+		void Return(asIScriptContext *ctx)
+		{
+			if (ctx == nullptr)
+				return;
+
+			asEContextState state = ctx->GetState();
+			if (state == asEXECUTION_ACTIVE)
+			{
+				// Still running (e.g. the Caller was released from within a script call) - can't be reused
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					decrement_in_use();
+				}
+				ctx->Release();
+				return;
+			}
+			if (state == asEXECUTION_SUSPENDED)
+				ctx->Abort();
+			ctx->Unprepare();
+			ctx->ClearLineCallback();
+			ctx->ClearExceptionCallback();
+
+			bool keep = false;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				decrement_in_use();
+				if (_idle.size() < _highWatermark)
+				{
+					_idle.push_back(ctx);
+					keep = true;
+				}
+				else
+					++_stats.discarded;
+				_stats.idle = _idle.size();
+			}
+
+			if (!keep)
+				ctx->Release();
+		}
+
+		//! Releases idle contexts until only the low watermark remain
+		void Trim()
+		{
+			std::vector<asIScriptContext*> surplus;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				while (_idle.size() > _lowWatermark)
+				{
+					surplus.push_back(_idle.back());
+					_idle.pop_back();
+				}
+				_stats.idle = _idle.size();
+			}
+
+			for (auto it = surplus.begin(), end = surplus.end(); it != end; ++it)
+				(*it)->Release();
+		}
+
+		//! Returns a copy of the usage counters
+		Stats GetStats() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _stats;
+		}
+
+		//! Zeros the hit / miss / discard counters and resets the peak to the current usage
+		void ResetStats()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stats.hits = 0;
+			_stats.misses = 0;
+			_stats.discarded = 0;
+			_stats.peak_in_use = _stats.in_use;
+		}
+
+		asIScriptEngine* GetEngine() const
+		{
+			return _engine;
+		}
+
+		//! Returns the pool for the given engine, or nullptr if it doesn't have one
+		static ContextPool* Get(asIScriptEngine *engine)
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			registry_type::iterator _where = registry().find(engine);
+			if (_where != registry().end())
+				return _where->second;
+			else
+				return nullptr;
+		}
+
+	private:
+		typedef std::unordered_map<asIScriptEngine*, ContextPool*> registry_type;
+
+		static registry_type& registry()
+		{
+			static registry_type pools;
+			return pools;
+		}
+
+		static std::mutex& registry_mutex()
+		{
+			static std::mutex m;
+			return m;
+		}
+
+		// Contexts created before the pool existed may be returned to it, so in_use can't be trusted to be > 0
+		void decrement_in_use()
+		{
+			if (_stats.in_use > 0)
+				--_stats.in_use;
+		}
+
+		//! Prevent copying
+		ContextPool(const ContextPool &);
+		//! Prevent copying
+		ContextPool & operator=(const ContextPool &);
+
+		asIScriptEngine *_engine;
+
+		size_t _lowWatermark;
+		size_t _highWatermark;
+
+		mutable std::mutex _mutex;
+		std::vector<asIScriptContext*> _idle;
+		Stats _stats;
+	};
+
+	//! Gets a context for the given engine
+	/*!
+	* Borrows from the engine's ContextPool if it has one, otherwise creates
+	* a new context. Give the context back with ReturnContext().
+	*/
+	inline asIScriptContext* AcquireContext(asIScriptEngine *engine)
+	{
+		ContextPool *pool = ContextPool::Get(engine);
+		if (pool != nullptr)
+			return pool->Acquire();
+		else
+			return engine->CreateContext();
+	}
+
+	//! Gives back a context gotten from AcquireContext()
+	/*!
+	* Returns it to the engine's pool if there (still) is one, otherwise the
+	* context is released.
+	*/
+	inline void ReturnContext(asIScriptContext *ctx)
+	{
+		ContextPool *pool = ContextPool::Get(ctx->GetEngine());
+		if (pool != nullptr)
+			pool->Return(ctx);
+		else
+			ctx->Release();
+	}
+
+}}
+
+#endif
@@ -0,0 +1,356 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_METHODBROADCAST
+#define H_SCRIPTUTILS_METHODBROADCAST
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+#include "CallMetrics.h"
+#include "ContextPool.h"
+#include "TypedCaller.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Returns the script object itself (see MethodBroadcast)
+	inline asIScriptObject* script_object_of(asIScriptObject *obj)
+	{
+		return obj;
+	}
+
+	//! Returns the script object held by a wrapper (anything with get_script_object(), e.g. ScriptObjectWrapper)
+	template <class Wrapper>
+	asIScriptObject* script_object_of(Wrapper *wrapper)
+	{
+		return wrapper != nullptr ? wrapper->get_script_object() : nullptr;
+	}
+
+	template <class Wrapper>
+	asIScriptObject* script_object_of(const std::shared_ptr<Wrapper> &wrapper)
+	{
+		return script_object_of(wrapper.get());
+	}
+
+	template <class Wrapper>
+	asIScriptObject* script_object_of(const std::unique_ptr<Wrapper> &wrapper)
+	{
+		return script_object_of(wrapper.get());
+	}
+
+	//! Describes an object that a broadcast method call failed on
+	struct BroadcastError
+	{
+		//! Index of the object in the range that was passed
+		size_t index;
+		//! The object (may be null)
+		asIScriptObject *object;
+		//! asNO_FUNCTION / asINVALID_TYPE / asINVALID_OBJECT if the method couldn't be called, otherwise the Execute() result
+		int result;
+		//! The script exception string, or a description of why the method couldn't be called
+		std::string message;
+
+		BroadcastError(size_t index_, asIScriptObject *object_, int result_, const std::string &message_)
+			: index(index_), object(object_), result(result_), message(message_)
+		{}
+	};
+
+	//! The outcome of a MethodBroadcast call
+	struct BroadcastResult
+	{
+		//! Number of objects the method finished executing on
+		size_t completed;
+		//! The objects the call failed on - those the method couldn't be resolved for first, then those that failed while executing
+		std::vector<BroadcastError> errors;
+
+		BroadcastResult()
+			: completed(0)
+		{}
+
+		bool ok() const { return errors.empty(); }
+	};
+
+	template <typename Signature>
+	class MethodCache;
+
+	//! Finds a method by declaration on script object types, caching the result per type
+	/*!
+	* Each method found is checked against <code>R (Args...)</code> (see
+	* SignatureTraits). Types that don't have the method, or have it with an
+	* incompatible signature, are cached too, along with the reason.
+	* <p>
+	* The cache holds a reference to each type (and method) in it, so a type's
+	* address can't be reused while it's cached. That also keeps the types of
+	* a discarded module alive, so call clear() when modules are rebuilt.
+	* </p>
+	*/
+	template <typename R, typename... Args>
+	class MethodCache<R (Args...)>
+	{
+	public:
+		struct entry
+		{
+			//! The method, or nullptr if it couldn't be used
+			asIScriptFunction *method;
+			//! asNO_FUNCTION or asINVALID_TYPE if method is null
+			int error;
+			//! Why method is null
+			std::string message;
+			//! How the args are passed to method
+			typename SignatureTraits<R (Args...)>::bound_args args;
+
+			entry()
+				: method(nullptr), error(0)
+			{}
+		};
+
+		MethodCache(const std::string &method_decl)
+			: _decl(method_decl),
+			_lastType(nullptr),
+			_lastEntry(nullptr)
+		{}
+
+		~MethodCache()
+		{
+			clear();
+		}
+
+		//! Releases the cached types and methods
+		void clear()
+		{
+			for (auto it = _methods.begin(), end = _methods.end(); it != end; ++it)
+			{
+				if (it->second.method != nullptr)
+					it->second.method->Release();
+				it->first->Release();
+			}
+			_methods.clear();
+			_lastType = nullptr;
+			_lastEntry = nullptr;
+		}
+
+		//! Returns the (cached) method entry for the given type
+		const entry &resolve(asIObjectType *type)
+		{
+			// Objects of the same type are often next to each other
+			if (type == _lastType)
+				return *_lastEntry;
+
+			auto _where = _methods.find(type);
+			if (_where == _methods.end())
+			{
+				entry &found = _methods[type];
+				type->AddRef();
+				asIScriptFunction *method = type->GetMethodByDecl(_decl.c_str());
+				if (method == nullptr)
+				{
+					found.error = asNO_FUNCTION;
+					found.message = std::string(type->GetName()) + " has no method " + _decl;
+				}
+				else if (!SignatureTraits<R (Args...)>::matches(method, &found.message))
+					found.error = asINVALID_TYPE;
+				else
+				{
+					found.method = method;
+					method->AddRef();
+					found.args = SignatureTraits<R (Args...)>::bind_args(method);
+				}
+				_where = _methods.find(type);
+			}
+
+			_lastType = type;
+			_lastEntry = &_where->second;
+			return *_lastEntry;
+		}
+
+		const std::string &get_declaration() const
+		{
+			return _decl;
+		}
+
+	private:
+		//! Prevent copying
+		MethodCache(const MethodCache &);
+		//! Prevent copying
+		MethodCache & operator=(const MethodCache &);
+
+		std::string _decl;
+		// Entries stay where they are when the map grows, so _lastEntry stays valid
+		std::unordered_map<asIObjectType*, entry> _methods;
+		asIObjectType *_lastType;
+		const entry *_lastEntry;
+	};
+
+	template <typename Signature>
+	class MethodBroadcast;
+
+	//! Calls a method on many script objects, using one context
+	/*!
+	* The method is looked up (by declaration) once for each object type, and
+	* its signature is checked against <code>R (Args...)</code> at the same time;
+	* the result is cached for later broadcasts. Objects are grouped by method
+	* before they're called, so the context is re-prepared with the same
+	* function for each group (which AngelScript does cheaply).
+	* <p>
+	* An object whose type doesn't have the method (or has it with an
+	* incompatible signature), a null object or a script exception doesn't stop
+	* the broadcast - they are listed in the returned BroadcastResult.
+	* Return values are ignored.
+	* </p>
+	*
+	* \code
+	* MethodBroadcast<void (float)> update(engine, "void Update(float)");
+	* BroadcastResult r = update(entities.begin(), entities.end(), dt);
+	* \endcode
+	*/
+	template <typename R, typename... Args>
+	class MethodBroadcast<R (Args...)>
+	{
+	public:
+		//! Constructor
+		/*!
+		* \param[in] engine
+		* The engine the objects belong to (the context is borrowed from its ContextPool).
+		*
+		* \param[in] method_decl
+		* Declaration of the method to call, e.g. "void Update(float)".
+		*/
+		MethodBroadcast(asIScriptEngine *engine, const std::string &method_decl)
+			: _engine(engine),
+			_ctx(AcquireContext(engine)),
+			_methods(method_decl)
+		{
+			if (_ctx == nullptr)
+				throw Exception("MethodBroadcast: failed to create a script context");
+		}
+
+		//! Destructor
+		~MethodBroadcast()
+		{
+			if (_ctx != nullptr)
+				ReturnContext(_ctx);
+		}
+
+		//! Calls the method on each object in [first, last)
+		/*!
+		* The range can hold asIScriptObject pointers, or wrappers (see script_object_of()).
+		*/
+		template <typename InputIt>
+		BroadcastResult operator()(InputIt first, InputIt last, Args... args)
+		{
+			BroadcastResult result;
+
+			_calls.clear();
+			size_t index = 0;
+			for (; first != last; ++first, ++index)
+			{
+				asIScriptObject *obj = script_object_of(*first);
+				if (obj == nullptr)
+				{
+					result.errors.push_back(BroadcastError(index, nullptr, asINVALID_OBJECT, "null object"));
+					continue;
+				}
+
+				const typename method_cache::entry &method = _methods.resolve(obj->GetObjectType());
+				if (method.method != nullptr)
+					_calls.push_back(call_entry(&method, std::make_pair(index, obj)));
+				else
+					result.errors.push_back(BroadcastError(index, obj, method.error, method.message));
+			}
+
+			// Group by method, keeping the original order within each group
+			std::stable_sort(_calls.begin(), _calls.end(), compare_method);
+
+			ArgCopies copies;
+			for (auto it = _calls.begin(), end = _calls.end(); it != end; ++it)
+			{
+				asIScriptObject *obj = it->second.second;
+				if (_ctx->Prepare(it->first->method) < 0 || _ctx->SetObject(obj) < 0)
+				{
+					result.errors.push_back(BroadcastError(it->second.first, obj, asCONTEXT_NOT_PREPARED, "failed to prepare the context"));
+					continue;
+				}
+				SignatureTraits<R (Args...)>::set_args(_ctx, it->first->args, copies, args...);
+
+				int r = CallMetrics::Execute(_ctx, it->first->method);
+				copies.release();
+				if (r == asEXECUTION_FINISHED)
+					++result.completed;
+				else
+				{
+					if (r == asEXECUTION_EXCEPTION)
+						result.errors.push_back(BroadcastError(it->second.first, obj, r, _ctx->GetExceptionString()));
+					else
+					{
+						if (r == asEXECUTION_SUSPENDED)
+							_ctx->Abort();
+						result.errors.push_back(BroadcastError(it->second.first, obj, r, std::string()));
+					}
+				}
+			}
+
+			// Don't hold on to the last object
+			_ctx->Unprepare();
+
+			return result;
+		}
+
+		//! Calls the method on each of count objects
+		BroadcastResult operator()(asIScriptObject *const *objects, size_t count, Args... args)
+		{
+			return (*this)(objects, objects + count, args...);
+		}
+
+		//! Returns the declaration of the method being called
+		const std::string &get_declaration() const
+		{
+			return _methods.get_declaration();
+		}
+
+		//! Forgets the methods found so far (call when modules are discarded / rebuilt)
+		void clear()
+		{
+			_calls.clear();
+			_methods.clear();
+		}
+
+	private:
+		//! Prevent copying
+		MethodBroadcast(const MethodBroadcast &);
+		//! Prevent copying
+		MethodBroadcast & operator=(const MethodBroadcast &);
+
+		typedef MethodCache<R (Args...)> method_cache;
+
+		// (method, (index, object))
+		typedef std::pair<const typename method_cache::entry*, std::pair<size_t, asIScriptObject*>> call_entry;
+
+		static bool compare_method(const call_entry &a, const call_entry &b)
+		{
+			return a.first->method < b.first->method;
+		}
+
+		asIScriptEngine *_engine;
+
+		asIScriptContext *_ctx;
+
+		method_cache _methods;
+		// Scratch list, kept between calls so that it doesn't have to be reallocated every frame
+		std::vector<call_entry> _calls;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,215 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SCRIPTCALLBACKS
+#define H_SCRIPTUTILS_SCRIPTCALLBACKS
+
+#include <angelscript.h>
+
+#include <boost/function.hpp>
+#include <memory>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	class ScriptCallbackList;
+
+	//! Handle to a callback connected to a ScriptCallbackList
+	/*!
+	* Works like boost::signals2::connection: disconnect() removes the
+	* callback, and does nothing if the list has been destroyed.
+	*/
+	class ScriptCallbackConnection
+	{
+	public:
+		ScriptCallbackConnection()
+			: _id(0)
+		{}
+
+		ScriptCallbackConnection(const std::weak_ptr<ScriptCallbackList> &list, unsigned int id)
+			: _list(list), _id(id)
+		{}
+
+		inline void disconnect() const;
+
+		inline bool connected() const;
+
+	private:
+		std::weak_ptr<ScriptCallbackList> _list;
+		unsigned int _id;
+	};
+
+	//! A flat list of context callbacks, called in the order they were connected
+	/*!
+	* Used by CallerBase for its line and exception callbacks. Dispatching takes
+	* no locks and doesn't allocate: it's a loop over an array of function
+	* pointer / user data pairs, so each callback costs one indirect call
+	* (callbacks connected as functors go through one more, to the functor).
+	* <p>
+	* Callbacks may be connected or disconnected from within a callback.
+	* Connecting isn't synchronised with dispatching, so don't change the list
+	* from another thread while the context it's attached to is executing.
+	* </p>
+	* <p>
+	* Once the list is empty() CallerBase clears the context's line callback,
+	* the next time it's called, so the context stops paying for it.
+	* </p>
+	*/
+	class ScriptCallbackList : public std::enable_shared_from_this<ScriptCallbackList>
+	{
+	public:
+		typedef void (*callback_fn)(asIScriptContext *ctx, void *data);
+		typedef boost::function<void (asIScriptContext*)> functor_type;
+
+		ScriptCallbackList()
+			: _nextId(1), _dispatching(0), _disconnected(0)
+		{}
+
+		//! Connects a plain function, called as fn(ctx, data)
+		ScriptCallbackConnection connect(callback_fn fn, void *data)
+		{
+			return add(fn, data, std::shared_ptr<functor_type>());
+		}
+
+		//! Connects a functor
+		ScriptCallbackConnection connect(functor_type fn)
+		{
+			std::shared_ptr<functor_type> functor = std::make_shared<functor_type>(std::move(fn));
+			return add(&call_functor, functor.get(), functor);
+		}
+
+		void disconnect(unsigned int id)
+		{
+			for (auto it = _entries.begin(), end = _entries.end(); it != end; ++it)
+			{
+				if (it->id == id)
+				{
+					// Entries are only removed outside of dispatch, so that dispatch can index safely
+					it->fn = nullptr;
+					it->id = 0;
+					++_disconnected;
+					compact();
+					return;
+				}
+			}
+		}
+
+		bool connected(unsigned int id) const
+		{
+			if (id == 0)
+				return false;
+			for (auto it = _entries.begin(), end = _entries.end(); it != end; ++it)
+				if (it->id == id)
+					return true;
+			return false;
+		}
+
+		void disconnect_all_slots()
+		{
+			for (auto it = _entries.begin(), end = _entries.end(); it != end; ++it)
+			{
+				it->fn = nullptr;
+				it->id = 0;
+			}
+			_disconnected = _entries.size();
+			compact();
+		}
+
+		//! Returns true if no callbacks are connected
+		bool empty() const
+		{
+			return _entries.size() == _disconnected;
+		}
+
+		//! Calls each connected callback
+		void operator()(asIScriptContext *ctx)
+		{
+			++_dispatching;
+			// Indexed, since a callback may connect another (which is first called next time)
+			const size_t count = _entries.size();
+			for (size_t i = 0; i < count; ++i)
+			{
+				const entry &e = _entries[i];
+				if (e.fn != nullptr)
+					e.fn(ctx, e.data);
+			}
+			--_dispatching;
+			if (_disconnected > 0)
+				compact();
+		}
+
+	private:
+		//! Prevent copying
+		ScriptCallbackList(const ScriptCallbackList &);
+		//! Prevent copying
+		ScriptCallbackList & operator=(const ScriptCallbackList &);
+
+		struct entry
+		{
+			callback_fn fn;
+			void *data;
+			unsigned int id;
+			//! Keeps a connected functor alive (null for plain functions)
+			std::shared_ptr<functor_type> functor;
+
+			entry(callback_fn fn_, void *data_, unsigned int id_, const std::shared_ptr<functor_type> &functor_)
+				: fn(fn_), data(data_), id(id_), functor(functor_)
+			{}
+		};
+
+		static void call_functor(asIScriptContext *ctx, void *data)
+		{
+			(*static_cast<functor_type*>(data))(ctx);
+		}
+
+		ScriptCallbackConnection add(callback_fn fn, void *data, const std::shared_ptr<functor_type> &functor)
+		{
+			unsigned int id = _nextId++;
+			_entries.push_back(entry(fn, data, id, functor));
+			return ScriptCallbackConnection(shared_from_this(), id);
+		}
+
+		void compact()
+		{
+			if (_dispatching > 0)
+				return;
+			size_t kept = 0;
+			for (size_t i = 0; i < _entries.size(); ++i)
+			{
+				if (_entries[i].fn != nullptr)
+				{
+					if (kept != i)
+						_entries[kept] = std::move(_entries[i]);
+					++kept;
+				}
+			}
+			_entries.resize(kept, entry(nullptr, nullptr, 0, std::shared_ptr<functor_type>()));
+			_disconnected = 0;
+		}
+
+		std::vector<entry> _entries;
+		unsigned int _nextId;
+		unsigned int _dispatching;
+		size_t _disconnected;
+	};
+
+	inline void ScriptCallbackConnection::disconnect() const
+	{
+		if (std::shared_ptr<ScriptCallbackList> list = _list.lock())
+			list->disconnect(_id);
+	}
+
+	inline bool ScriptCallbackConnection::connected() const
+	{
+		std::shared_ptr<ScriptCallbackList> list = _list.lock();
+		return list && list->connected(_id);
+	}
+
+}}
+
+#endif
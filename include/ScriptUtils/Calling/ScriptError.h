@@ -0,0 +1,402 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SCRIPTERROR
+#define H_SCRIPTUTILS_SCRIPTERROR
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Describes why a try_call() failed
+	/*!
+	* Creating one doesn't allocate: it holds the error code, the function and
+	* (for script exceptions) a reference to the context, and only builds the
+	* message text when message() is called.
+	* <p>
+	* The script exception text is read from the context, so call message() (or
+	* exception_string()) before the caller that failed is called again.
+	* </p>
+	*/
+	class ScriptError
+	{
+	public:
+		enum Code
+		{
+			//! The caller isn't valid, or its context couldn't be prepared
+			NotPrepared,
+			//! Too many arguments were given
+			BadArgCount,
+			//! An argument was of the wrong type
+			BadArgType,
+			//! The script threw an exception
+			ScriptException,
+			//! The script suspended itself
+			Suspended,
+			//! Execution was aborted
+			Aborted,
+			//! Execute() failed for some other reason
+			ExecutionFailed
+		};
+
+		ScriptError(Code code, int result, asIScriptFunction *function, asIScriptContext *ctx = nullptr, int arg_index = -1)
+			: _code(code), _result(result), _function(function), _ctx(ctx), _argIndex(arg_index), _line(0)
+		{
+			if (_ctx != nullptr)
+			{
+				_ctx->AddRef();
+				if (_code == ScriptException)
+					_line = _ctx->GetExceptionLineNumber();
+			}
+		}
+
+		ScriptError(const ScriptError &other)
+			: _code(other._code), _result(other._result), _function(other._function), _ctx(other._ctx), _argIndex(other._argIndex), _line(other._line)
+		{
+			if (_ctx != nullptr)
+				_ctx->AddRef();
+		}
+
+		ScriptError(ScriptError &&other)
+			: _code(other._code), _result(other._result), _function(other._function), _ctx(other._ctx), _argIndex(other._argIndex), _line(other._line)
+		{
+			other._ctx = nullptr;
+		}
+
+		~ScriptError()
+		{
+			if (_ctx != nullptr)
+				_ctx->Release();
+		}
+
+		ScriptError& operator= (ScriptError other)
+		{
+			std::swap(_code, other._code);
+			std::swap(_result, other._result);
+			std::swap(_function, other._function);
+			std::swap(_ctx, other._ctx);
+			std::swap(_argIndex, other._argIndex);
+			std::swap(_line, other._line);
+			return *this;
+		}
+
+		//! Makes an error from the (unsuccessful) result of asIScriptContext#Execute()
+		static ScriptError FromExecuteResult(int result, asIScriptFunction *function, asIScriptContext *ctx)
+		{
+			switch (result)
+			{
+			case asEXECUTION_EXCEPTION:
+				return ScriptError(ScriptException, result, function, ctx);
+			case asEXECUTION_SUSPENDED:
+				return ScriptError(Suspended, result, function);
+			case asEXECUTION_ABORTED:
+				return ScriptError(Aborted, result, function);
+			case asCONTEXT_NOT_PREPARED:
+				return ScriptError(NotPrepared, result, function);
+			default:
+				return ScriptError(ExecutionFailed, result, function);
+			}
+		}
+
+		//! Makes an error from the (unsuccessful) result of setting an arg
+		static ScriptError FromSetArgResult(int result, asUINT arg, asIScriptFunction *function)
+		{
+			if (result == asINVALID_ARG)
+				return ScriptError(BadArgCount, result, function, nullptr, int(arg));
+			if (result == asINVALID_TYPE)
+				return ScriptError(BadArgType, result, function, nullptr, int(arg));
+			return ScriptError(NotPrepared, result, function, nullptr, int(arg));
+		}
+
+		Code code() const { return _code; }
+
+		//! The AngelScript return code / execution state that caused the error
+		int result() const { return _result; }
+
+		asIScriptFunction *function() const { return _function; }
+
+		int function_id() const { return _function != nullptr ? _function->GetId() : 0; }
+
+		//! The arg that couldn't be set (BadArgCount / BadArgType), otherwise -1
+		int arg_index() const { return _argIndex; }
+
+		//! The line the script exception was thrown on (ScriptException), otherwise 0
+		int line() const { return _line; }
+
+		//! The script exception text (ScriptException), without copying it
+		/*!
+		* Returns an empty string if this isn't a script exception, or the
+		* context has been used again since.
+		*/
+		const char *exception_string() const
+		{
+			if (_code != ScriptException || _ctx == nullptr || _ctx->GetState() != asEXECUTION_EXCEPTION)
+				return "";
+			const char *text = _ctx->GetExceptionString();
+			return text != nullptr ? text : "";
+		}
+
+		//! Formats a description of the error
+		std::string message() const
+		{
+			std::string decl = _function != nullptr ? _function->GetDeclaration() : "invalid function object";
+			switch (_code)
+			{
+			case NotPrepared:
+				return "Can't execute " + decl + " - Caller is not prepared to execute";
+			case BadArgCount:
+				return "Caller: Was given too many arguments (" + std::to_string(_argIndex + 1) + ") for " + decl;
+			case BadArgType:
+				return "Caller: Argument " + std::to_string(_argIndex) + " passed to " + decl + " is of incorrect type";
+			case ScriptException:
+				return std::string("Script Exception: ") + exception_string() + " (in " + decl + ", line " + std::to_string(_line) + ")";
+			case Suspended:
+				return decl + " was suspended";
+			case Aborted:
+				return decl + " was aborted";
+			default:
+				return "Error while executing " + decl;
+			}
+		}
+
+	private:
+		Code _code;
+		int _result;
+		asIScriptFunction *_function;
+		asIScriptContext *_ctx;
+		int _argIndex;
+		int _line;
+	};
+
+	//! Holds either a value or an error (see try_call())
+	template <typename T, typename E = ScriptError>
+	class Expected
+	{
+		typedef void (Expected::*safe_bool)() const;
+		void this_type_does_not_support_comparisons() const {}
+	public:
+		Expected(const T &value)
+			: _hasValue(true)
+		{
+			new (&_storage) T(value);
+		}
+
+		Expected(T &&value)
+			: _hasValue(true)
+		{
+			new (&_storage) T(std::move(value));
+		}
+
+		Expected(const E &error)
+			: _hasValue(false)
+		{
+			new (&_storage) E(error);
+		}
+
+		Expected(E &&error)
+			: _hasValue(false)
+		{
+			new (&_storage) E(std::move(error));
+		}
+
+		Expected(const Expected &other)
+			: _hasValue(other._hasValue)
+		{
+			if (_hasValue)
+				new (&_storage) T(other.get_value());
+			else
+				new (&_storage) E(other.get_error());
+		}
+
+		Expected(Expected &&other)
+			: _hasValue(other._hasValue)
+		{
+			if (_hasValue)
+				new (&_storage) T(std::move(other.get_value()));
+			else
+				new (&_storage) E(std::move(other.get_error()));
+		}
+
+		~Expected()
+		{
+			destroy();
+		}
+
+		Expected& operator= (Expected other)
+		{
+			destroy();
+			_hasValue = other._hasValue;
+			if (_hasValue)
+				new (&_storage) T(std::move(other.get_value()));
+			else
+				new (&_storage) E(std::move(other.get_error()));
+			return *this;
+		}
+
+		bool has_value() const
+		{
+			return _hasValue;
+		}
+
+		operator safe_bool() const
+		{
+			return _hasValue ? &Expected::this_type_does_not_support_comparisons : 0;
+		}
+
+		//! Returns the value, or throws an Exception with the error message
+		T &value()
+		{
+			check();
+			return get_value();
+		}
+
+		const T &value() const
+		{
+			check();
+			return get_value();
+		}
+
+		T value_or(T default_value) const
+		{
+			return _hasValue ? get_value() : default_value;
+		}
+
+		T &operator*() { return get_value(); }
+		const T &operator*() const { return get_value(); }
+		T *operator->() { return &get_value(); }
+		const T *operator->() const { return &get_value(); }
+
+		//! Returns the error (only valid if has_value() is false)
+		const E &error() const
+		{
+			return get_error();
+		}
+
+	private:
+		void check() const
+		{
+			if (!_hasValue)
+				throw Exception(get_error().message());
+		}
+
+		void destroy()
+		{
+			if (_hasValue)
+				get_value().~T();
+			else
+				get_error().~E();
+		}
+
+		T &get_value() { return *reinterpret_cast<T*>(&_storage); }
+		const T &get_value() const { return *reinterpret_cast<const T*>(&_storage); }
+		E &get_error() { return *reinterpret_cast<E*>(&_storage); }
+		const E &get_error() const { return *reinterpret_cast<const E*>(&_storage); }
+
+		union storage_type
+		{
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+			typename std::aligned_storage<sizeof(E), alignof(E)>::type error;
+		};
+
+		storage_type _storage;
+		bool _hasValue;
+	};
+
+	//! The result of a try_call() on a function that returns void: success or an error
+	template <typename E>
+	class Expected<void, E>
+	{
+		typedef void (Expected::*safe_bool)() const;
+		void this_type_does_not_support_comparisons() const {}
+	public:
+		Expected()
+			: _hasValue(true)
+		{}
+
+		Expected(const E &error)
+			: _hasValue(false)
+		{
+			new (&_storage) E(error);
+		}
+
+		Expected(E &&error)
+			: _hasValue(false)
+		{
+			new (&_storage) E(std::move(error));
+		}
+
+		Expected(const Expected &other)
+			: _hasValue(other._hasValue)
+		{
+			if (!_hasValue)
+				new (&_storage) E(other.get_error());
+		}
+
+		Expected(Expected &&other)
+			: _hasValue(other._hasValue)
+		{
+			if (!_hasValue)
+				new (&_storage) E(std::move(other.get_error()));
+		}
+
+		~Expected()
+		{
+			if (!_hasValue)
+				get_error().~E();
+		}
+
+		Expected& operator= (Expected other)
+		{
+			if (!_hasValue)
+				get_error().~E();
+			_hasValue = other._hasValue;
+			if (!_hasValue)
+				new (&_storage) E(std::move(other.get_error()));
+			return *this;
+		}
+
+		bool has_value() const
+		{
+			return _hasValue;
+		}
+
+		operator safe_bool() const
+		{
+			return _hasValue ? &Expected::this_type_does_not_support_comparisons : 0;
+		}
+
+		//! Throws an Exception with the error message if the call failed
+		void value() const
+		{
+			if (!_hasValue)
+				throw Exception(get_error().message());
+		}
+
+		const E &error() const
+		{
+			return get_error();
+		}
+
+	private:
+		E &get_error() { return *reinterpret_cast<E*>(&_storage); }
+		const E &get_error() const { return *reinterpret_cast<const E*>(&_storage); }
+
+		typename std::aligned_storage<sizeof(E), alignof(E)>::type _storage;
+		bool _hasValue;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SCRIPTHANDLE
+#define H_SCRIPTUTILS_SCRIPTHANDLE
+
+#include <angelscript.h>
+
+#include <utility>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! An owning reference to a script (or registered reference type) object
+	/*!
+	* Holds a reference, which is added with AddRefScriptObject() and released
+	* with ReleaseScriptObject(), so it works for any reference type without
+	* knowing how it's reference counted. Returned by callers for functions that
+	* return handles - e.g. <code>TypedCaller<ScriptHandle<asIScriptObject> ()></code> -
+	* so that the object stays alive after the context lets go of it.
+	*/
+	template <typename T>
+	class ScriptHandle
+	{
+		typedef void (ScriptHandle::*safe_bool)() const;
+		void this_type_does_not_support_comparisons() const {}
+	public:
+		ScriptHandle()
+			: _ptr(nullptr), _engine(nullptr), _typeId(0)
+		{}
+
+		//! Constructor - adds a reference to ptr
+		/*!
+		* \param[in] type_id
+		* The type-id of the object (handle flags are ignored).
+		*/
+		ScriptHandle(T *ptr, asIScriptEngine *engine, int type_id)
+			: _ptr(ptr), _engine(engine), _typeId(type_id & ~(asTYPEID_OBJHANDLE | asTYPEID_HANDLETOCONST))
+		{
+			add_ref();
+		}
+
+		ScriptHandle(const ScriptHandle &other)
+			: _ptr(other._ptr), _engine(other._engine), _typeId(other._typeId)
+		{
+			add_ref();
+		}
+
+		ScriptHandle(ScriptHandle &&other)
+			: _ptr(other._ptr), _engine(other._engine), _typeId(other._typeId)
+		{
+			other._ptr = nullptr;
+		}
+
+		~ScriptHandle()
+		{
+			reset();
+		}
+
+		ScriptHandle& operator= (ScriptHandle other)
+		{
+			std::swap(_ptr, other._ptr);
+			std::swap(_engine, other._engine);
+			std::swap(_typeId, other._typeId);
+			return *this;
+		}
+
+		//! Releases the reference
+		void reset()
+		{
+			if (_ptr != nullptr)
+				_engine->ReleaseScriptObject(_ptr, _typeId);
+			_ptr = nullptr;
+		}
+
+		//! Gives up ownership of the reference, without releasing it
+		T *detach()
+		{
+			T *ptr = _ptr;
+			_ptr = nullptr;
+			return ptr;
+		}
+
+		T *get() const { return _ptr; }
+		T *operator->() const { return _ptr; }
+		T &operator*() const { return *_ptr; }
+
+		operator safe_bool() const
+		{
+			return _ptr != nullptr ? &ScriptHandle::this_type_does_not_support_comparisons : 0;
+		}
+
+		asIScriptEngine *get_engine() const { return _engine; }
+
+		int get_typeid() const { return _typeId; }
+
+	private:
+		void add_ref()
+		{
+			if (_ptr != nullptr)
+				_engine->AddRefScriptObject(_ptr, _typeId);
+		}
+
+		T *_ptr;
+		asIScriptEngine *_engine;
+		int _typeId;
+	};
+
+}}
+
+#endif
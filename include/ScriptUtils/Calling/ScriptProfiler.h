@@ -0,0 +1,409 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SCRIPTPROFILER
+#define H_SCRIPTUTILS_SCRIPTPROFILER
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+#include "CallerBase.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Samples the call stacks of running scripts
+	/*!
+	* Contexts are attached with Attach() (usually those of existing Callers).
+	* Samples are taken in one (or both) of two ways:
+	* - every Nth script line, if a line interval is given to the constructor
+	* - at a fixed rate, while Start() has a watchdog thread running. The
+	* watchdog only flags the attached contexts; each context records the
+	* sample itself at its next line, since a context can't safely be
+	* inspected from another thread while it runs.
+	*
+	* Between samples the cost is one line callback doing a flag check and a
+	* countdown. Output is collapsed stacks (for flamegraph.pl and similar
+	* tools) and a per-function self / total table.
+	*
+	* \code
+	* ScriptProfiler profiler;
+	* profiler.Attach(updateCaller);
+	* profiler.Start(std::chrono::milliseconds(1));
+	* ...
+	* profiler.Stop();
+	* std::ofstream folded("script.folded");
+	* profiler.WriteCollapsed(folded);
+	* \endcode
+	*
+	* The profiler must outlive the contexts attached to it, or they must be
+	* detached (see Attach()) first. Sampled functions are kept alive (AddRef)
+	* until Reset().
+	*/
+	class ScriptProfiler
+	{
+	public:
+		//! A frame of a sampled stack
+		struct Frame
+		{
+			asIScriptFunction *function;
+			//! The line being executed (the call site, for calling frames)
+			int line;
+
+			Frame(asIScriptFunction *function_, int line_)
+				: function(function_), line(line_)
+			{}
+
+			bool operator==(const Frame &other) const
+			{
+				return function == other.function && line == other.line;
+			}
+		};
+
+		//! Samples per function
+		struct FunctionStats
+		{
+			//! "Object::name (section)"
+			std::string name;
+			asIScriptFunction *function;
+			//! Samples where the function was executing
+			size_t self;
+			//! Samples where the function was on the stack
+			size_t total;
+
+			FunctionStats()
+				: function(nullptr), self(0), total(0)
+			{}
+		};
+
+		//! Constructor
+		/*!
+		* \param[in] line_interval
+		* Take a sample every line_interval script lines in each attached
+		* context (0 to only sample from the watchdog thread - see Start()).
+		*/
+		explicit ScriptProfiler(unsigned int line_interval = 0)
+			: _lineInterval(line_interval),
+			_running(false),
+			_sampleCount(0)
+		{}
+
+		//! Destructor - stops the watchdog and disconnects from the attached callers
+		~ScriptProfiler()
+		{
+			Stop();
+			for (auto it = _connections.begin(), end = _connections.end(); it != end; ++it)
+				it->disconnect();
+			Reset();
+		}
+
+		//! Samples the given caller's context
+		/*!
+		* Disconnect the returned connection to detach.
+		*/
+		CallerBase::callback_connection Attach(CallerBase &caller)
+		{
+			probe *p = add_probe();
+#ifdef SCRIPTUTILS_USE_SIGNALS2
+			CallerBase::callback_connection connection = caller.ConnectLineCallback([p](asIScriptContext *ctx) { on_line(ctx, p); });
+#else
+			CallerBase::callback_connection connection = caller.ConnectLineCallback(&on_line, p);
+#endif
+			_connections.push_back(connection);
+			return connection;
+		}
+
+		//! Samples a context that isn't managed by a Caller
+		/*!
+		* This sets the context's line callback, replacing any existing one;
+		* detach by calling ClearLineCallback() on the context.
+		*/
+		void Attach(asIScriptContext *ctx)
+		{
+			ctx->SetLineCallback(asFUNCTION(on_line), add_probe(), asCALL_CDECL);
+		}
+
+		//! Starts a watchdog thread that requests a sample from each attached context once per period
+		void Start(std::chrono::microseconds period)
+		{
+			Stop();
+			_running = true;
+			_watchdog = std::thread(&ScriptProfiler::watchdog_loop, this, period);
+		}
+
+		//! Stops the watchdog thread
+		void Stop()
+		{
+			if (!_watchdog.joinable())
+				return;
+			{
+				std::lock_guard<std::mutex> lock(_watchdogMutex);
+				_running = false;
+			}
+			_wake.notify_all();
+			_watchdog.join();
+		}
+
+		//! Discards the samples taken so far
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(_sampleMutex);
+			_stacks.clear();
+			_sampleCount = 0;
+			for (auto it = _functions.begin(), end = _functions.end(); it != end; ++it)
+				(*it)->Release();
+			_functions.clear();
+		}
+
+		size_t GetSampleCount() const
+		{
+			std::lock_guard<std::mutex> lock(_sampleMutex);
+			return _sampleCount;
+		}
+
+		//! Writes the samples as collapsed stacks ("root;caller;callee count" per line)
+		/*!
+		* \param[in] with_lines
+		* Label each frame with its line number, so that hot lines show up
+		* separately.
+		*/
+		void WriteCollapsed(std::ostream &stream, bool with_lines = false) const
+		{
+			std::map<std::string, size_t> collapsed;
+			{
+				std::lock_guard<std::mutex> lock(_sampleMutex);
+				std::string key;
+				for (auto it = _stacks.begin(), end = _stacks.end(); it != end; ++it)
+				{
+					key.clear();
+					for (auto frame = it->first.begin(), frames_end = it->first.end(); frame != frames_end; ++frame)
+					{
+						if (!key.empty())
+							key += ';';
+						key += function_name(frame->function);
+						if (with_lines)
+						{
+							key += ':';
+							key += std::to_string(frame->line);
+						}
+					}
+					collapsed[key] += it->second;
+				}
+			}
+
+			for (auto it = collapsed.begin(), end = collapsed.end(); it != end; ++it)
+				stream << it->first << ' ' << it->second << '\n';
+		}
+
+		//! Returns the self / total sample counts per function, highest self count first
+		std::vector<FunctionStats> GetFunctionStats() const
+		{
+			std::unordered_map<asIScriptFunction*, FunctionStats> byFunction;
+			{
+				std::lock_guard<std::mutex> lock(_sampleMutex);
+				std::set<asIScriptFunction*> seen;
+				for (auto it = _stacks.begin(), end = _stacks.end(); it != end; ++it)
+				{
+					const stack_type &stack = it->first;
+					if (stack.empty())
+						continue;
+
+					byFunction[stack.back().function].self += it->second;
+
+					// Recursive functions only count once per sample
+					seen.clear();
+					for (auto frame = stack.begin(), frames_end = stack.end(); frame != frames_end; ++frame)
+					{
+						if (seen.insert(frame->function).second)
+							byFunction[frame->function].total += it->second;
+					}
+				}
+			}
+
+			std::vector<FunctionStats> stats;
+			stats.reserve(byFunction.size());
+			for (auto it = byFunction.begin(), end = byFunction.end(); it != end; ++it)
+			{
+				it->second.function = it->first;
+				it->second.name = function_name(it->first);
+				stats.push_back(it->second);
+			}
+			std::sort(stats.begin(), stats.end(), [](const FunctionStats &a, const FunctionStats &b)
+			{
+				return a.self != b.self ? a.self > b.self : a.total > b.total;
+			});
+			return stats;
+		}
+
+		//! Writes GetFunctionStats() as a text table
+		void WriteTable(std::ostream &stream) const
+		{
+			std::vector<FunctionStats> stats = GetFunctionStats();
+			size_t samples = GetSampleCount();
+			double scale = samples > 0 ? 100.0 / samples : 0.0;
+
+			stream << "   self  self%   total total%  function\n";
+			for (auto it = stats.begin(), end = stats.end(); it != end; ++it)
+			{
+				char row[64];
+				std::snprintf(row, sizeof(row), "%7u %5.1f%% %7u %5.1f%%  ",
+					(unsigned int)it->self, it->self * scale, (unsigned int)it->total, it->total * scale);
+				stream << row << it->name << '\n';
+			}
+		}
+
+	private:
+		//! Prevent copying
+		ScriptProfiler(const ScriptProfiler &);
+		//! Prevent copying
+		ScriptProfiler & operator=(const ScriptProfiler &);
+
+		//! Root first
+		typedef std::vector<Frame> stack_type;
+
+		struct stack_hash
+		{
+			size_t operator()(const stack_type &stack) const
+			{
+				size_t h = stack.size();
+				for (auto it = stack.begin(), end = stack.end(); it != end; ++it)
+				{
+					h ^= std::hash<void*>()(it->function) + 0x9e3779b9 + (h << 6) + (h >> 2);
+					h ^= std::hash<int>()(it->line) + 0x9e3779b9 + (h << 6) + (h >> 2);
+				}
+				return h;
+			}
+		};
+
+		//! Per-context sampling state (the line callback's user data)
+		struct probe
+		{
+			ScriptProfiler *profiler;
+			std::atomic<bool> requested;
+			unsigned int countdown;
+
+			explicit probe(ScriptProfiler *profiler_)
+				: profiler(profiler_), requested(false), countdown(profiler_->_lineInterval)
+			{}
+		};
+
+		probe *add_probe()
+		{
+			std::lock_guard<std::mutex> lock(_watchdogMutex);
+			_probes.push_back(std::unique_ptr<probe>(new probe(this)));
+			return _probes.back().get();
+		}
+
+		static void on_line(asIScriptContext *ctx, void *data)
+		{
+			probe &p = *static_cast<probe*>(data);
+			if (p.requested.load(std::memory_order_relaxed))
+			{
+				p.requested.store(false, std::memory_order_relaxed);
+				p.profiler->record(ctx);
+			}
+			else if (p.countdown != 0 && --p.countdown == 0)
+			{
+				p.countdown = p.profiler->_lineInterval;
+				p.profiler->record(ctx);
+			}
+		}
+
+		void record(asIScriptContext *ctx)
+		{
+			static thread_local stack_type stack;
+			stack.clear();
+			for (asUINT i = ctx->GetCallstackSize(); i > 0; --i)
+			{
+				asIScriptFunction *function = ctx->GetFunction(i - 1);
+				if (function != nullptr)
+					stack.push_back(Frame(function, ctx->GetLineNumber(i - 1)));
+			}
+
+			std::lock_guard<std::mutex> lock(_sampleMutex);
+			++_sampleCount;
+			auto _where = _stacks.find(stack);
+			if (_where != _stacks.end())
+			{
+				++_where->second;
+				return;
+			}
+
+			for (auto it = stack.begin(), end = stack.end(); it != end; ++it)
+			{
+				if (_functions.insert(it->function).second)
+					it->function->AddRef();
+			}
+			_stacks.insert(std::make_pair(stack, size_t(1)));
+		}
+
+		void watchdog_loop(std::chrono::microseconds period)
+		{
+			std::unique_lock<std::mutex> lock(_watchdogMutex);
+			while (!_wake.wait_for(lock, period, [this] { return !_running; }))
+			{
+				for (auto it = _probes.begin(), end = _probes.end(); it != end; ++it)
+					(*it)->requested.store(true, std::memory_order_relaxed);
+			}
+		}
+
+		static std::string function_name(asIScriptFunction *function)
+		{
+			std::string name;
+			const char *objectName = function->GetObjectName();
+			if (objectName != nullptr && objectName[0] != '\0')
+			{
+				name = objectName;
+				name += "::";
+			}
+			name += function->GetName();
+			const char *section = function->GetScriptSectionName();
+			if (section != nullptr && section[0] != '\0')
+			{
+				name += " (";
+				name += section;
+				name += ')';
+			}
+			return name;
+		}
+
+		unsigned int _lineInterval;
+
+		// Guards _probes and _running
+		std::mutex _watchdogMutex;
+		std::condition_variable _wake;
+		std::thread _watchdog;
+		bool _running;
+		std::vector<std::unique_ptr<probe>> _probes;
+
+		std::vector<CallerBase::callback_connection> _connections;
+
+		// Samples may be recorded by contexts running on any thread
+		mutable std::mutex _sampleMutex;
+		std::unordered_map<stack_type, size_t, stack_hash> _stacks;
+		std::set<asIScriptFunction*> _functions;
+		size_t _sampleCount;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,340 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SHAREDCALLER
+#define H_SCRIPTUTILS_SHAREDCALLER
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+#include "CallMetrics.h"
+#include "MethodBroadcast.h"
+#include "ThreadContexts.h"
+#include "ThreadPool.h"
+#include "TypedCaller.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	template <typename Signature>
+	class SharedCaller;
+
+	//! A caller that can be shared between threads
+	/*!
+	* Unlike Caller / TypedCaller, a SharedCaller doesn't own a context: each
+	* call borrows one from the calling thread's ThreadContexts, so the same
+	* SharedCaller can be invoked from any number of threads at once. The
+	* signature is checked once, when the caller is created (see TypedCaller).
+	* <p>
+	* AngelScript's multithreading rules still apply: create a MultithreadScope
+	* before the engine, and don't let scripts running at the same time touch
+	* the same unsynchronised data.
+	* </p>
+	* Script exceptions (and other unfinished executions) are thrown as
+	* Exception, since there's no per-caller state to report them through.
+	*/
+	template <typename R, typename... Args>
+	class SharedCaller<R (Args...)>
+	{
+		typedef void (SharedCaller::*safe_bool)() const;
+		void this_type_does_not_support_comparisons() const {}
+	public:
+		//! Default constructor
+		SharedCaller()
+			: _func(nullptr), _obj(nullptr), _returnTypeId(asTYPEID_VOID), _returnFlags(0)
+		{}
+
+		//! Constructor
+		/*!
+		* \param[in] function
+		* The function to call. If it is null, the caller isn't ok.
+		*
+		* \param[in] obj
+		* The object to call the method on, or null for global functions.
+		*/
+		SharedCaller(asIScriptFunction *function, asIScriptObject *obj = nullptr)
+			: _func(function), _obj(obj), _returnTypeId(asTYPEID_VOID), _returnFlags(0)
+		{
+			if (_func != nullptr)
+			{
+				std::string error;
+				if (!SignatureTraits<R (Args...)>::matches(_func, &error))
+					throw Exception("SharedCaller: " + error);
+				_returnTypeId = _func->GetReturnTypeId(&_returnFlags);
+				if (!DetachedReturn<R>::accepts(_returnTypeId, _returnFlags))
+					throw Exception(std::string("SharedCaller: ") + _func->GetDeclaration() +
+						" returns an object that's released with the context, so it can't be returned as a pointer - use ScriptHandle<T>");
+				_boundArgs = SignatureTraits<R (Args...)>::bind_args(_func);
+			}
+			add_ref();
+		}
+
+		//! Copy constructor
+		SharedCaller(const SharedCaller &other)
+			: _func(other._func), _obj(other._obj), _returnTypeId(other._returnTypeId), _returnFlags(other._returnFlags), _boundArgs(other._boundArgs)
+		{
+			add_ref();
+		}
+
+		//! Destructor
+		~SharedCaller()
+		{
+			release();
+		}
+
+		//! Copy-assignment operator
+		SharedCaller& operator= (const SharedCaller &other)
+		{
+			if (this != &other)
+			{
+				release();
+				_func = other._func;
+				_obj = other._obj;
+				_returnTypeId = other._returnTypeId;
+				_returnFlags = other._returnFlags;
+				_boundArgs = other._boundArgs;
+				add_ref();
+			}
+			return *this;
+		}
+
+		//! Creates a caller for a global method
+		static SharedCaller Create(asIScriptEngine *engine, const std::string& method_decl)
+		{
+			return SharedCaller(engine->GetGlobalFunctionByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for a global method
+		static SharedCaller Create(asIScriptModule *module, const std::string& method_decl)
+		{
+			return SharedCaller(module->GetFunctionByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for an object method
+		static SharedCaller Create(asIScriptObject *object, const std::string& method_decl)
+		{
+			return SharedCaller(object->GetObjectType()->GetMethodByDecl(method_decl.c_str()), object);
+		}
+
+		bool is_ok() const
+		{
+			return _func != nullptr;
+		}
+
+		operator safe_bool() const
+		{
+			return is_ok() ? &SharedCaller::this_type_does_not_support_comparisons : 0;
+		}
+
+		//! Calls the function on the calling thread
+		R operator()(Args... args) const
+		{
+			if (_func == nullptr)
+				throw Exception("Can't execute - SharedCaller is not valid");
+
+			ThreadContext ctx(_func->GetEngine());
+			if (ctx->Prepare(_func) < 0 || (_obj != nullptr && ctx->SetObject(_obj) < 0))
+				throw Exception(std::string("Can't execute ") + _func->GetDeclaration() + " - failed to prepare the context");
+
+			// Declared after ctx, so the copies are released before the context is given back
+			ArgCopies copies;
+			SignatureTraits<R (Args...)>::set_args(ctx, _boundArgs, copies, args...);
+
+			int r = CallMetrics::Execute(ctx, _func);
+			if (r == asEXECUTION_EXCEPTION)
+				throw Exception(std::string("Script Exception: ") + ctx->GetExceptionString());
+			else if (r != asEXECUTION_FINISHED)
+				throw Exception(std::string("Error while executing ") + _func->GetDeclaration());
+
+			return ScriptReturnTraits<R>::get(ctx, _returnTypeId, _returnFlags);
+		}
+
+		asIScriptFunction* get_func() const
+		{
+			return _func;
+		}
+
+		asIScriptObject* get_object() const
+		{
+			return _obj;
+		}
+
+	private:
+		void add_ref()
+		{
+			if (_func != nullptr)
+				_func->AddRef();
+			if (_obj != nullptr)
+				_obj->AddRef();
+		}
+
+		void release()
+		{
+			if (_func != nullptr)
+				_func->Release();
+			if (_obj != nullptr)
+				_obj->Release();
+			_func = nullptr;
+			_obj = nullptr;
+		}
+
+		asIScriptFunction *_func;
+		asIScriptObject *_obj;
+		int _returnTypeId;
+		asDWORD _returnFlags;
+		typename SignatureTraits<R (Args...)>::bound_args _boundArgs;
+	};
+
+	template <typename Signature>
+	class ParallelBroadcast;
+
+	//! Calls a method on many script objects, spread over a WorkStealingPool
+	/*!
+	* The multi-threaded version of MethodBroadcast: methods are resolved per
+	* type on the calling thread, then the calls are split into chunks of
+	* grain_size objects and run by the pool's workers, each chunk using one of
+	* its worker's ThreadContexts. The calls must be independent of each other.
+	*
+	* \code
+	* WorkStealingPool pool;
+	* ParallelBroadcast<void (float)> update("void Update(float)");
+	* BroadcastResult r = update(pool, entities.data(), entities.size(), dt);
+	* \endcode
+	*/
+	template <typename R, typename... Args>
+	class ParallelBroadcast<R (Args...)>
+	{
+	public:
+		//! Constructor
+		/*!
+		* \param[in] method_decl
+		* Declaration of the method to call, e.g. "void Update(float)".
+		*
+		* \param[in] grain_size
+		* Number of objects handled per task.
+		*/
+		ParallelBroadcast(const std::string &method_decl, size_t grain_size = 64)
+			: _methods(method_decl),
+			_grainSize(grain_size)
+		{}
+
+		//! Calls the method on each of count objects
+		/*!
+		* The objects can be asIScriptObject pointers, or wrappers (see script_object_of()).
+		*/
+		template <typename Object>
+		BroadcastResult operator()(WorkStealingPool &pool, Object const *objects, size_t count, Args... args)
+		{
+			BroadcastResult result;
+
+			_calls.clear();
+			for (size_t index = 0; index < count; ++index)
+			{
+				asIScriptObject *obj = script_object_of(objects[index]);
+				if (obj == nullptr)
+				{
+					result.errors.push_back(BroadcastError(index, nullptr, asINVALID_OBJECT, "null object"));
+					continue;
+				}
+
+				const typename method_cache::entry &method = _methods.resolve(obj->GetObjectType());
+				if (method.method != nullptr)
+					_calls.push_back(call_entry(&method, index, obj));
+				else
+					result.errors.push_back(BroadcastError(index, obj, method.error, method.message));
+			}
+
+			std::atomic<size_t> completed(0);
+			std::mutex errorMutex;
+
+			const size_t callCount = _calls.size();
+			const size_t grain = _grainSize > 0 ? _grainSize : 1;
+			const size_t chunks = (callCount + grain - 1) / grain;
+			parallel_for(pool, 0, chunks, 1, [&](size_t chunk)
+			{
+				std::vector<BroadcastError> errors;
+				size_t finished = 0;
+
+				size_t begin = chunk * grain, end = begin + grain < callCount ? begin + grain : callCount;
+				ThreadContext ctx(_calls[begin].method->method->GetEngine());
+				ArgCopies copies;
+				for (size_t i = begin; i < end; ++i)
+				{
+					const call_entry &call = _calls[i];
+					if (ctx->Prepare(call.method->method) < 0 || ctx->SetObject(call.obj) < 0)
+					{
+						errors.push_back(BroadcastError(call.index, call.obj, asCONTEXT_NOT_PREPARED, "failed to prepare the context"));
+						continue;
+					}
+					SignatureTraits<R (Args...)>::set_args(ctx, call.method->args, copies, args...);
+
+					int r = CallMetrics::Execute(ctx, call.method->method);
+					copies.release();
+					if (r == asEXECUTION_FINISHED)
+						++finished;
+					else if (r == asEXECUTION_EXCEPTION)
+						errors.push_back(BroadcastError(call.index, call.obj, r, ctx->GetExceptionString()));
+					else
+					{
+						if (r == asEXECUTION_SUSPENDED)
+							ctx->Abort();
+						errors.push_back(BroadcastError(call.index, call.obj, r, std::string()));
+					}
+				}
+
+				completed += finished;
+				if (!errors.empty())
+				{
+					std::lock_guard<std::mutex> lock(errorMutex);
+					result.errors.insert(result.errors.end(), errors.begin(), errors.end());
+				}
+			});
+
+			result.completed = completed;
+			return result;
+		}
+
+		const std::string &get_declaration() const
+		{
+			return _methods.get_declaration();
+		}
+
+		//! Forgets the methods found so far (call when modules are discarded / rebuilt)
+		void clear()
+		{
+			_calls.clear();
+			_methods.clear();
+		}
+
+	private:
+		typedef MethodCache<R (Args...)> method_cache;
+
+		struct call_entry
+		{
+			const typename method_cache::entry *method;
+			size_t index;
+			asIScriptObject *obj;
+
+			call_entry(const typename method_cache::entry *method_, size_t index_, asIScriptObject *obj_)
+				: method(method_), index(index_), obj(obj_)
+			{}
+		};
+
+		method_cache _methods;
+		size_t _grainSize;
+		// Scratch list, kept between calls so that it doesn't have to be reallocated every frame
+		std::vector<call_entry> _calls;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,183 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_THREADCONTEXTS
+#define H_SCRIPTUTILS_THREADCONTEXTS
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+
+#include <unordered_map>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Prepares AngelScript for use from multiple threads for as long as it exists
+	/*!
+	* Calls asPrepareMultithread() on construction and asUnprepareMultithread()
+	* on destruction. Create one (e.g. at the top of main()) before creating any
+	* engine that will be used from more than one thread.
+	*/
+	class MultithreadScope
+	{
+	public:
+		MultithreadScope()
+		{
+			if (asPrepareMultithread() < 0)
+				throw Exception("MultithreadScope: asPrepareMultithread failed");
+		}
+
+		~MultithreadScope()
+		{
+			asUnprepareMultithread();
+		}
+
+	private:
+		//! Prevent copying
+		MultithreadScope(const MultithreadScope &);
+		//! Prevent copying
+		MultithreadScope & operator=(const MultithreadScope &);
+	};
+
+	//! Per-thread sets of idle contexts, one set per engine
+	/*!
+	* Unlike ContextPool this needs no locking: each thread only ever touches its
+	* own contexts. Contexts are handed out as a stack, so nested calls on the
+	* same thread (a script calling application code which calls a script again)
+	* each get their own context.
+	* <p>
+	* Before a thread exits (or before an engine is released) call
+	* ReleaseAll() on that thread, followed by asThreadCleanup() if the thread
+	* is exiting. WorkStealingPool's workers do this themselves. That includes
+	* the main thread: its contexts are only released when thread_local
+	* objects are destroyed, which is after a normal engine shutdown, so call
+	* ReleaseAll(engine) on it before releasing the engine.
+	* </p>
+	*/
+	class ThreadContexts
+	{
+	public:
+		//! Gets an idle context for the given engine that belongs to this thread, creating one if necessary
+		static asIScriptContext* Acquire(asIScriptEngine *engine)
+		{
+			std::vector<asIScriptContext*> &idle = local().idle[engine];
+			if (!idle.empty())
+			{
+				asIScriptContext *ctx = idle.back();
+				idle.pop_back();
+				return ctx;
+			}
+			return engine->CreateContext();
+		}
+
+		//! Gives back a context gotten from Acquire() (on the same thread)
+		/*!
+		* The context is unprepared, so that an idle context doesn't keep the
+		* last function (and its return value or object) alive. Contexts keep
+		* their stack memory, so preparing one again still doesn't allocate.
+		*/
+		static void Return(asIScriptContext *ctx)
+		{
+			asEContextState state = ctx->GetState();
+			if (state == asEXECUTION_ACTIVE)
+			{
+				ctx->Release();
+				return;
+			}
+			if (state == asEXECUTION_SUSPENDED)
+				ctx->Abort();
+			ctx->Unprepare();
+
+			local().idle[ctx->GetEngine()].push_back(ctx);
+		}
+
+		//! Releases all of this thread's idle contexts
+		static void ReleaseAll()
+		{
+			local().release_all();
+		}
+
+		//! Releases this thread's idle contexts for the given engine
+		static void ReleaseAll(asIScriptEngine *engine)
+		{
+			thread_data &data = local();
+			auto _where = data.idle.find(engine);
+			if (_where != data.idle.end())
+			{
+				release(_where->second);
+				data.idle.erase(_where);
+			}
+		}
+
+	private:
+		typedef std::unordered_map<asIScriptEngine*, std::vector<asIScriptContext*>> engine_contexts;
+
+		struct thread_data
+		{
+			engine_contexts idle;
+
+			~thread_data()
+			{
+				release_all();
+			}
+
+			void release_all()
+			{
+				for (auto it = idle.begin(), end = idle.end(); it != end; ++it)
+					release(it->second);
+				idle.clear();
+			}
+		};
+
+		static void release(std::vector<asIScriptContext*> &contexts)
+		{
+			for (auto it = contexts.begin(), end = contexts.end(); it != end; ++it)
+				(*it)->Release();
+			contexts.clear();
+		}
+
+		static thread_data& local()
+		{
+			static thread_local thread_data data;
+			return data;
+		}
+	};
+
+	//! Borrows a context from ThreadContexts for the lifetime of this object
+	class ThreadContext
+	{
+	public:
+		explicit ThreadContext(asIScriptEngine *engine)
+			: _ctx(ThreadContexts::Acquire(engine))
+		{
+			if (_ctx == nullptr)
+				throw Exception("ThreadContext: failed to create a script context");
+		}
+
+		~ThreadContext()
+		{
+			ThreadContexts::Return(_ctx);
+		}
+
+		asIScriptContext* get() const { return _ctx; }
+		asIScriptContext* operator->() const { return _ctx; }
+		operator asIScriptContext*() const { return _ctx; }
+
+	private:
+		//! Prevent copying
+		ThreadContext(const ThreadContext &);
+		//! Prevent copying
+		ThreadContext & operator=(const ThreadContext &);
+
+		asIScriptContext *_ctx;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,278 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_THREADPOOL
+#define H_SCRIPTUTILS_THREADPOOL
+
+#include <angelscript.h>
+
+#include "ThreadContexts.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! A fixed set of worker threads, each with its own task queue
+	/*!
+	* Workers take tasks from the back of their own queue, and steal from the
+	* front of the other workers' queues when theirs is empty. Tasks submitted
+	* from a worker go to that worker's queue; tasks submitted from any other
+	* thread are spread over the queues round-robin.
+	* <p>
+	* Workers are script-aware: before exiting each one releases its
+	* ThreadContexts and calls asThreadCleanup(). Remember to create a
+	* MultithreadScope before the engine if scripts are run on the workers.
+	* </p>
+	*
+	* \see parallel_for()
+	*/
+	class WorkStealingPool
+	{
+	public:
+		typedef std::function<void ()> task_type;
+
+		//! Constructor
+		/*!
+		* \param[in] thread_count
+		* Number of workers. With zero workers, parallel_for() runs everything
+		* on the calling thread.
+		*/
+		explicit WorkStealingPool(unsigned int thread_count = std::thread::hardware_concurrency())
+			: _stop(false),
+			_pending(0),
+			_next(0)
+		{
+			for (unsigned int i = 0; i < thread_count; ++i)
+				_queues.push_back(std::unique_ptr<worker_queue>(new worker_queue));
+			for (unsigned int i = 0; i < thread_count; ++i)
+				_threads.push_back(std::thread(&WorkStealingPool::worker_loop, this, i));
+		}
+
+		//! Destructor - finishes the queued tasks, then joins the workers
+		~WorkStealingPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_sleepMutex);
+				_stop = true;
+			}
+			_wake.notify_all();
+			for (auto it = _threads.begin(), end = _threads.end(); it != end; ++it)
+				it->join();
+		}
+
+		//! Number of worker threads
+		size_t GetThreadCount() const
+		{
+			return _threads.size();
+		}
+
+		//! Queues a task
+		void Submit(task_type task)
+		{
+			if (_queues.empty())
+			{
+				task();
+				return;
+			}
+
+			size_t queue;
+			if (current().pool == this)
+				queue = current().index;
+			else
+				queue = _next++ % _queues.size();
+
+			// Counted before it's queued, so that _pending never drops below the number of queued tasks
+			{
+				std::lock_guard<std::mutex> lock(_sleepMutex);
+				++_pending;
+			}
+			{
+				std::lock_guard<std::mutex> lock(_queues[queue]->mutex);
+				_queues[queue]->tasks.push_back(std::move(task));
+			}
+			_wake.notify_one();
+		}
+
+		//! Runs one queued task on the calling thread, if there are any
+		/*!
+		* Used by threads that are waiting for tasks to finish, so that they help
+		* rather than block.
+		*
+		* \returns
+		* True if a task was run.
+		*/
+		bool RunOne()
+		{
+			task_type task;
+			size_t self = current().pool == this ? current().index : 0;
+			if (!take(self, task))
+				return false;
+			task();
+			return true;
+		}
+
+	private:
+		//! Prevent copying
+		WorkStealingPool(const WorkStealingPool &);
+		//! Prevent copying
+		WorkStealingPool & operator=(const WorkStealingPool &);
+
+		struct worker_queue
+		{
+			std::mutex mutex;
+			std::deque<task_type> tasks;
+		};
+
+		struct thread_info
+		{
+			WorkStealingPool *pool;
+			size_t index;
+		};
+
+		static thread_info& current()
+		{
+			static thread_local thread_info info = { nullptr, 0 };
+			return info;
+		}
+
+		//! Pops from the back of queue self, or steals from the front of another
+		bool take(size_t self, task_type &task)
+		{
+			const size_t count = _queues.size();
+			for (size_t i = 0; i < count; ++i)
+			{
+				worker_queue &queue = *_queues[(self + i) % count];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				if (!queue.tasks.empty())
+				{
+					if (i == 0)
+					{
+						task = std::move(queue.tasks.back());
+						queue.tasks.pop_back();
+					}
+					else
+					{
+						task = std::move(queue.tasks.front());
+						queue.tasks.pop_front();
+					}
+					--_pending;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void worker_loop(size_t index)
+		{
+			current().pool = this;
+			current().index = index;
+
+			for (;;)
+			{
+				task_type task;
+				if (take(index, task))
+				{
+					task();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(_sleepMutex);
+				if (_stop && _pending == 0)
+					break;
+				_wake.wait(lock, [this] { return _stop || _pending > 0; });
+				if (_stop && _pending == 0)
+					break;
+			}
+
+			// Contexts have to be released before AngelScript's thread-local data is cleaned up
+			ThreadContexts::ReleaseAll();
+			asThreadCleanup();
+		}
+
+		std::vector<std::unique_ptr<worker_queue>> _queues;
+		std::vector<std::thread> _threads;
+
+		std::mutex _sleepMutex;
+		std::condition_variable _wake;
+		bool _stop;
+		std::atomic<size_t> _pending;
+
+		std::atomic<size_t> _next;
+	};
+
+	//! Calls fn(i) for each i in [begin, end), spread over the pool's workers
+	/*!
+	* The range is split into chunks of grain_size indices. The calling thread
+	* runs tasks too while it waits, so parallel_for can be called from within a
+	* task. If fn throws, the first exception is rethrown once all chunks have
+	* finished.
+	*
+	* \code
+	* parallel_for(pool, 0, objects.size(), 64, [&](size_t i) { ... });
+	* \endcode
+	*/
+	template <typename Fn>
+	void parallel_for(WorkStealingPool &pool, size_t begin, size_t end, size_t grain_size, Fn fn)
+	{
+		if (begin >= end)
+			return;
+		if (grain_size == 0)
+			grain_size = 1;
+
+		if (pool.GetThreadCount() == 0 || end - begin <= grain_size)
+		{
+			for (size_t i = begin; i < end; ++i)
+				fn(i);
+			return;
+		}
+
+		std::atomic<size_t> remaining((end - begin + grain_size - 1) / grain_size);
+		std::mutex errorMutex;
+		std::exception_ptr error;
+
+		for (size_t chunk = begin; chunk < end; chunk += grain_size)
+		{
+			size_t chunkEnd = (end - chunk > grain_size) ? chunk + grain_size : end;
+			pool.Submit([&, chunk, chunkEnd]
+			{
+				try
+				{
+					for (size_t i = chunk; i < chunkEnd; ++i)
+						fn(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error)
+						error = std::current_exception();
+				}
+				--remaining;
+			});
+		}
+
+		while (remaining > 0)
+		{
+			if (!pool.RunOne())
+				std::this_thread::yield();
+		}
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+}}
+
+#endif
@@ -0,0 +1,304 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_TIMESLICESCHEDULER
+#define H_SCRIPTUTILS_TIMESLICESCHEDULER
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+#include "CallerBase.h"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Runs many script calls side by side, a quantum at a time, within a per-frame budget
+	/*!
+	* Each task is a prepared caller (args already set with CallerBase#set_arg()).
+	* A task runs until its quantum is used up - a number of script lines and/or
+	* an amount of time - at which point its context is suspended; it's resumed
+	* on its next turn. Tasks take turns round-robin, and a task with priority p
+	* gets p+1 quanta per turn. Tasks that weren't reached before the frame
+	* budget ran out go first next frame, so every task keeps making progress.
+	* <p>
+	* The quantum is enforced by a plain line callback set directly on the
+	* context (not CallerBase's line signal), so slots connected with
+	* CallerBase#ConnectLineCallback() aren't called while a task is scheduled.
+	* </p>
+	*
+	* \code
+	* TimeSliceScheduler scheduler(500, std::chrono::microseconds(200));
+	* Caller think = Caller::Create(obj, "void Think(int)");
+	* think.set_arg(0, 3);
+	* scheduler.Spawn(std::move(think));
+	* // each frame:
+	* scheduler.RunFrame(std::chrono::milliseconds(2));
+	* \endcode
+	*/
+	class TimeSliceScheduler
+	{
+	public:
+		typedef unsigned int task_id;
+		typedef std::chrono::steady_clock clock;
+
+		//! Per-task accounting
+		struct TaskStats
+		{
+			task_id id;
+			int priority;
+			//! Number of times the task was executed / resumed
+			size_t slices;
+			//! Number of script lines executed
+			size_t lines;
+			//! Time spent executing the task
+			clock::duration cpu_time;
+			//! The last Execute() result (asEXECUTION_SUSPENDED while the task is running)
+			int result;
+
+			TaskStats()
+				: id(0), priority(0), slices(0), lines(0), cpu_time(clock::duration::zero()), result(asEXECUTION_PREPARED)
+			{}
+		};
+
+		//! Called when a task finishes / throws / is killed, while its context still holds the result
+		typedef std::function<void (const TaskStats&, asIScriptContext*)> completion_fn;
+
+		//! Constructor
+		/*!
+		* \param[in] line_quantum
+		* Number of script lines a task may run per quantum (0 for no limit).
+		*
+		* \param[in] time_quantum
+		* Time a task may run per quantum (zero for no limit). The clock is
+		* read every few lines, so a quantum can overrun slightly.
+		*/
+		explicit TimeSliceScheduler(asUINT line_quantum = 1000, clock::duration time_quantum = clock::duration::zero())
+			: _lineQuantum(line_quantum),
+			_timeQuantum(time_quantum),
+			_nextId(1)
+		{
+			if (_lineQuantum == 0 && _timeQuantum == clock::duration::zero())
+				throw Exception("TimeSliceScheduler: a line quantum or a time quantum is needed");
+		}
+
+		//! Destructor - aborts any tasks that haven't finished (without calling the completion handler)
+		~TimeSliceScheduler()
+		{
+			for (auto it = _tasks.begin(), end = _tasks.end(); it != end; ++it)
+				(*it)->detach();
+		}
+
+		//! Sets the function called when a task completes
+		void SetCompletionHandler(completion_fn fn)
+		{
+			_onComplete = std::move(fn);
+		}
+
+		//! Adds a task
+		/*!
+		* \param[in] caller
+		* A caller that is prepared to execute, with its args set.
+		*
+		* \param[in] priority
+		* Extra quanta the task gets per turn (negative values count as 0).
+		*/
+		task_id Spawn(CallerBase &&caller, int priority = 0)
+		{
+			if (!caller.is_ok() || caller.get_ctx() == nullptr || caller.GetState() != asEXECUTION_PREPARED)
+				throw Exception("TimeSliceScheduler: can't spawn a caller that isn't prepared to execute");
+
+			std::unique_ptr<task> t(new task(std::move(caller)));
+			t->stats.id = _nextId++;
+			t->stats.priority = priority;
+			t->caller.get_ctx()->SetLineCallback(asFUNCTION(task::line_callback), t.get(), asCALL_CDECL);
+
+			task_id id = t->stats.id;
+			_byId[id] = t.get();
+			_tasks.push_back(std::move(t));
+			return id;
+		}
+
+		//! Runs tasks until each has had a turn, or the budget is spent
+		/*!
+		* \param[in] budget
+		* Time available for this frame (zero to give every task a turn).
+		*
+		* \returns
+		* Number of quanta run
+		*/
+		size_t RunFrame(clock::duration budget = clock::duration::zero())
+		{
+			const bool limited = budget > clock::duration::zero();
+			const clock::time_point frameEnd = clock::now() + budget;
+
+			size_t quanta = 0;
+			for (size_t turns = _tasks.size(); turns > 0 && !_tasks.empty(); --turns)
+			{
+				if (limited && clock::now() >= frameEnd)
+					break;
+
+				std::unique_ptr<task> t = std::move(_tasks.front());
+				_tasks.pop_front();
+
+				bool running = true;
+				for (int q = t->stats.priority > 0 ? t->stats.priority : 0; q >= 0 && running; --q)
+				{
+					running = run_quantum(*t, limited, frameEnd);
+					++quanta;
+					if (limited && clock::now() >= frameEnd)
+						break;
+				}
+
+				if (running)
+					_tasks.push_back(std::move(t));
+				else
+					complete(*t);
+			}
+			return quanta;
+		}
+
+		//! Aborts a task (the completion handler is called with result asEXECUTION_ABORTED)
+		bool Kill(task_id id)
+		{
+			for (auto it = _tasks.begin(), end = _tasks.end(); it != end; ++it)
+			{
+				if ((*it)->stats.id == id)
+				{
+					std::unique_ptr<task> t = std::move(*it);
+					_tasks.erase(it);
+					t->caller.get_ctx()->Abort();
+					t->stats.result = asEXECUTION_ABORTED;
+					complete(*t);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool SetPriority(task_id id, int priority)
+		{
+			auto _where = _byId.find(id);
+			if (_where == _byId.end())
+				return false;
+			_where->second->stats.priority = priority;
+			return true;
+		}
+
+		//! Gets the accounting for a task that is still scheduled
+		bool GetStats(task_id id, TaskStats &stats) const
+		{
+			auto _where = _byId.find(id);
+			if (_where == _byId.end())
+				return false;
+			stats = _where->second->stats;
+			return true;
+		}
+
+		//! Number of tasks that haven't finished
+		size_t GetTaskCount() const
+		{
+			return _tasks.size();
+		}
+
+	private:
+		//! Prevent copying
+		TimeSliceScheduler(const TimeSliceScheduler &);
+		//! Prevent copying
+		TimeSliceScheduler & operator=(const TimeSliceScheduler &);
+
+		//! How many lines run between clock reads when there's a time quantum
+		static const asUINT time_check_interval = 16;
+
+		struct task
+		{
+			CallerBase caller;
+			TaskStats stats;
+
+			//! Lines left in the current quantum
+			asUINT linesLeft;
+			//! Lines until the clock is next read
+			asUINT checkCountdown;
+			bool timed;
+			clock::time_point deadline;
+
+			explicit task(CallerBase &&caller_)
+				: caller(std::move(caller_)), linesLeft(0), checkCountdown(0), timed(false)
+			{}
+
+			void detach()
+			{
+				asIScriptContext *ctx = caller.get_ctx();
+				ctx->ClearLineCallback();
+				if (ctx->GetState() == asEXECUTION_SUSPENDED)
+					ctx->Abort();
+			}
+
+			static void line_callback(asIScriptContext *ctx, void *param)
+			{
+				task &t = *static_cast<task*>(param);
+				++t.stats.lines;
+				if (t.linesLeft != 0 && --t.linesLeft == 0)
+					ctx->Suspend();
+				else if (t.timed && --t.checkCountdown == 0)
+				{
+					t.checkCountdown = time_check_interval;
+					if (clock::now() >= t.deadline)
+						ctx->Suspend();
+				}
+			}
+		};
+
+		//! Runs one quantum of the given task; returns true if it hasn't finished
+		bool run_quantum(task &t, bool limited, clock::time_point frame_end)
+		{
+			clock::time_point start = clock::now();
+
+			t.linesLeft = _lineQuantum;
+			t.checkCountdown = time_check_interval;
+			t.timed = limited || _timeQuantum > clock::duration::zero();
+			if (_timeQuantum > clock::duration::zero())
+				t.deadline = limited && frame_end < start + _timeQuantum ? frame_end : start + _timeQuantum;
+			else
+				t.deadline = frame_end;
+
+			int r = t.caller.get_ctx()->Execute();
+
+			++t.stats.slices;
+			t.stats.cpu_time += clock::now() - start;
+			t.stats.result = r;
+			return r == asEXECUTION_SUSPENDED;
+		}
+
+		void complete(task &t)
+		{
+			_byId.erase(t.stats.id);
+			t.caller.get_ctx()->ClearLineCallback();
+			if (_onComplete)
+				_onComplete(t.stats, t.caller.get_ctx());
+		}
+
+		asUINT _lineQuantum;
+		clock::duration _timeQuantum;
+
+		task_id _nextId;
+		// Front is next to run; tasks go to the back after their turn
+		std::deque<std::unique_ptr<task>> _tasks;
+		std::unordered_map<task_id, task*> _byId;
+
+		completion_fn _onComplete;
+	};
+
+}}
+
+#endif
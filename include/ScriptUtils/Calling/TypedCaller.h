@@ -0,0 +1,762 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_TYPEDCALLER
+#define H_SCRIPTUTILS_TYPEDCALLER
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+#include "CallerBase.h"
+#include "ScriptError.h"
+#include "ScriptHandle.h"
+
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+
+
+namespace ScriptUtils { namespace Calling
+{
+
+	//! Returns the AngelScript type-id of an integer type with the given size / signedness
+	template <size_t Size, bool Signed>
+	struct IntegralTypeId { static const int value = -1; };
+
+	template <> struct IntegralTypeId<1, true> { static const int value = asTYPEID_INT8; };
+	template <> struct IntegralTypeId<2, true> { static const int value = asTYPEID_INT16; };
+	template <> struct IntegralTypeId<4, true> { static const int value = asTYPEID_INT32; };
+	template <> struct IntegralTypeId<8, true> { static const int value = asTYPEID_INT64; };
+	template <> struct IntegralTypeId<1, false> { static const int value = asTYPEID_UINT8; };
+	template <> struct IntegralTypeId<2, false> { static const int value = asTYPEID_UINT16; };
+	template <> struct IntegralTypeId<4, false> { static const int value = asTYPEID_UINT32; };
+	template <> struct IntegralTypeId<8, false> { static const int value = asTYPEID_UINT64; };
+
+	//! Sets an integer arg using the SetArgX fn. that matches its size
+	template <size_t Size>
+	struct IntegralArgSetter;
+
+	template <> struct IntegralArgSetter<1> { template <typename T> static void set(asIScriptContext *ctx, asUINT arg, T t) { ctx->SetArgByte(arg, (asBYTE)t); } };
+	template <> struct IntegralArgSetter<2> { template <typename T> static void set(asIScriptContext *ctx, asUINT arg, T t) { ctx->SetArgWord(arg, (asWORD)t); } };
+	template <> struct IntegralArgSetter<4> { template <typename T> static void set(asIScriptContext *ctx, asUINT arg, T t) { ctx->SetArgDWord(arg, (asDWORD)t); } };
+	template <> struct IntegralArgSetter<8> { template <typename T> static void set(asIScriptContext *ctx, asUINT arg, T t) { ctx->SetArgQWord(arg, (asQWORD)t); } };
+
+	//! Gets an integer return value using the GetReturnX fn. that matches its size
+	template <size_t Size>
+	struct IntegralReturnGetter;
+
+	template <> struct IntegralReturnGetter<1> { template <typename T> static T get(asIScriptContext *ctx) { return (T)ctx->GetReturnByte(); } };
+	template <> struct IntegralReturnGetter<2> { template <typename T> static T get(asIScriptContext *ctx) { return (T)ctx->GetReturnWord(); } };
+	template <> struct IntegralReturnGetter<4> { template <typename T> static T get(asIScriptContext *ctx) { return (T)ctx->GetReturnDWord(); } };
+	template <> struct IntegralReturnGetter<8> { template <typename T> static T get(asIScriptContext *ctx) { return (T)ctx->GetReturnQWord(); } };
+
+	//! Describes how a C++ type is passed to a script function
+	/*!
+	* <code>accepts()</code> is used once, when a TypedCaller is bound, to check
+	* that the C++ type is compatible with the script parameter;
+	* <code>set()</code> is then used for every call, without any checking.
+	* <p>
+	* The default (for class types) is passed according to the ObjectArgMode
+	* worked out for the param at bind time (see SignatureTraits#bind_args()),
+	* so const &in params get the address of the C++ object without a copy.
+	* </p>
+	*/
+	template <typename T, typename Enable = void>
+	struct ScriptArgTraits
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD)
+		{
+			if (!is_object_typeid(typeId) || (typeId & asTYPEID_OBJHANDLE))
+				return false;
+			asIObjectType *type = engine->GetObjectTypeById(typeId);
+			return type != nullptr && type->GetSize() == sizeof(T);
+		}
+
+		static void set(asIScriptContext *ctx, asUINT arg, const T &t, int typeId, ObjectArgMode mode, ArgCopies &copies)
+		{
+			set_object_arg(ctx, arg, &t, typeId, mode, copies);
+		}
+	};
+
+	//! Primitives are passed by value, so reference params (which need an address) take a T* instead
+	template <>
+	struct ScriptArgTraits<bool>
+	{
+		static bool accepts(asIScriptEngine *, int typeId, asDWORD flags) { return typeId == asTYPEID_BOOL && (flags & asTM_INOUTREF) == 0; }
+		static void set(asIScriptContext *ctx, asUINT arg, bool t) { ctx->SetArgByte(arg, t ? 1 : 0); }
+	};
+
+	template <typename T>
+	struct ScriptArgTraits<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+	{
+		static bool accepts(asIScriptEngine *, int typeId, asDWORD flags)
+		{
+			if ((flags & asTM_INOUTREF) != 0)
+				return false;
+			const int expected = IntegralTypeId<sizeof(T), std::is_signed<T>::value>::value;
+			// Script enums are 32-bit ints
+			return typeId == expected || (sizeof(T) == 4 && is_enum_typeid(typeId));
+		}
+		static void set(asIScriptContext *ctx, asUINT arg, T t) { IntegralArgSetter<sizeof(T)>::set(ctx, arg, t); }
+	};
+
+	template <typename T>
+	struct ScriptArgTraits<T, typename std::enable_if<std::is_enum<T>::value>::type>
+	{
+		static bool accepts(asIScriptEngine *, int typeId, asDWORD flags) { return (typeId == asTYPEID_INT32 || is_enum_typeid(typeId)) && (flags & asTM_INOUTREF) == 0; }
+		static void set(asIScriptContext *ctx, asUINT arg, T t) { ctx->SetArgDWord(arg, (asDWORD)t); }
+	};
+
+	template <>
+	struct ScriptArgTraits<float>
+	{
+		static bool accepts(asIScriptEngine *, int typeId, asDWORD flags) { return typeId == asTYPEID_FLOAT && (flags & asTM_INOUTREF) == 0; }
+		static void set(asIScriptContext *ctx, asUINT arg, float t) { ctx->SetArgFloat(arg, t); }
+	};
+
+	template <>
+	struct ScriptArgTraits<double>
+	{
+		static bool accepts(asIScriptEngine *, int typeId, asDWORD flags) { return typeId == asTYPEID_DOUBLE && (flags & asTM_INOUTREF) == 0; }
+		static void set(asIScriptContext *ctx, asUINT arg, double t) { ctx->SetArgDouble(arg, t); }
+	};
+
+	//! Checks that T is the type of the objects / values that a script type-id refers to
+	/*!
+	* Used for pointer args and returns. The default is for class types:
+	* asIScriptObject (or a class derived from it) for script classes, or a
+	* registered type that T could be (of the same size - reference types that
+	* were registered with a size of 0 are taken on trust).
+	*/
+	template <typename T, typename Enable = void>
+	struct PointeeTraits
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId)
+		{
+			if (!is_object_typeid(typeId))
+				return false;
+			const bool scriptObject = std::is_base_of<asIScriptObject, T>::value;
+			if ((typeId & asTYPEID_SCRIPTOBJECT) != 0)
+				return scriptObject;
+			if (scriptObject)
+				return false;
+			asIObjectType *type = engine->GetObjectTypeById(typeId);
+			if (type == nullptr)
+				return false;
+			return type->GetSize() == sizeof(T) || ((type->GetFlags() & asOBJ_REF) != 0 && type->GetSize() == 0);
+		}
+	};
+
+	//! Pointers to primitives refer to values of the matching primitive type
+	template <typename T>
+	struct PointeeTraits<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId)
+		{
+			return !is_object_typeid(typeId) && ScriptArgTraits<T>::accepts(engine, typeId, 0);
+		}
+	};
+
+	//! void pointers can refer to anything
+	template <>
+	struct PointeeTraits<void>
+	{
+		static bool accepts(asIScriptEngine *, int) { return true; }
+	};
+
+	//! Pointers are passed to reference params, handles and by-value object params
+	/*!
+	* Handles and by-value objects are passed with SetArgObject() (so handles
+	* get the reference that the script releases when it returns), references
+	* by address (see ArgSetter<T*>).
+	*/
+	template <typename T>
+	struct ScriptArgTraits<T*>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags)
+		{
+			if (!PointeeTraits<typename std::remove_cv<T>::type>::accepts(engine, typeId))
+				return false;
+			const bool byRef = (flags & asTM_INOUTREF) != 0;
+			if (!is_object_typeid(typeId))
+				return byRef;
+			// A reference to a handle would need a T**
+			return !byRef || (typeId & asTYPEID_OBJHANDLE) == 0;
+		}
+
+		static void set(asIScriptContext *ctx, asUINT arg, T *t, int typeId, ObjectArgMode mode, ArgCopies &copies)
+		{
+			if (is_object_typeid(typeId))
+				set_object_arg(ctx, arg, t, typeId, mode, copies);
+			else
+				ctx->SetArgAddress(arg, (void*)t);
+		}
+	};
+
+	//! Moves a returned object, or copies it if the script returned a reference (the object still belongs to the script)
+	/*!
+	* \param[in] flags
+	* The return type's flags (see asIScriptFunction#GetReturnTypeId()).
+	*/
+	template <typename R>
+	R take_return_value(R *value, asDWORD flags)
+	{
+		if ((flags & (asTM_INOUTREF | asTM_CONST)) != 0)
+			return *value;
+		return std::move(*value);
+	}
+
+	//! Describes how a script function's return value is converted to a C++ type
+	/*!
+	* As with ScriptArgTraits, <code>accepts()</code> is checked once at bind time
+	* and <code>get()</code> does no checking. Both are given the return type's
+	* flags, from asIScriptFunction#GetReturnTypeId().
+	*/
+	template <typename R, typename Enable = void>
+	struct ScriptReturnTraits
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD)
+		{
+			if (!is_object_typeid(typeId) || (typeId & asTYPEID_OBJHANDLE))
+				return false;
+			asIObjectType *type = engine->GetObjectTypeById(typeId);
+			return type != nullptr && type->GetSize() == sizeof(R);
+		}
+		//! The context owns an object returned by value (and destroys it when it's next prepared), so it can be moved from
+		static R get(asIScriptContext *ctx, int, asDWORD flags)
+		{
+			return take_return_value(static_cast<R*>(ctx->GetReturnObject()), flags);
+		}
+	};
+
+	//! Handle returns, as owning references
+	/*!
+	* Also accepts reference types returned by reference. Value types aren't
+	* reference counted - the context destroys them - so they're rejected.
+	*/
+	template <typename T>
+	struct ScriptReturnTraits<ScriptHandle<T>>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD)
+		{
+			if (!is_object_typeid(typeId))
+				return false;
+			if ((typeId & asTYPEID_OBJHANDLE) != 0)
+				return true;
+			asIObjectType *type = engine->GetObjectTypeById(typeId);
+			return type != nullptr && (type->GetFlags() & asOBJ_REF) != 0 && (type->GetFlags() & asOBJ_SCOPED) == 0;
+		}
+		static ScriptHandle<T> get(asIScriptContext *ctx, int typeId, asDWORD)
+		{
+			return ScriptHandle<T>(static_cast<T*>(ctx->GetReturnObject()), ctx->GetEngine(), typeId);
+		}
+	};
+
+	template <>
+	struct ScriptReturnTraits<void>
+	{
+		static bool accepts(asIScriptEngine *, int typeId, asDWORD) { return typeId == asTYPEID_VOID; }
+		static void get(asIScriptContext *, int, asDWORD) {}
+	};
+
+	//! Primitives returned by reference are read through ScriptReturnTraits<T*>, as the value register holds their address
+	template <>
+	struct ScriptReturnTraits<bool>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags) { return ScriptArgTraits<bool>::accepts(engine, typeId, flags); }
+		static bool get(asIScriptContext *ctx, int, asDWORD) { return ctx->GetReturnByte() != 0; }
+	};
+
+	template <typename R>
+	struct ScriptReturnTraits<R, typename std::enable_if<std::is_integral<R>::value && !std::is_same<R, bool>::value>::type>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags) { return ScriptArgTraits<R>::accepts(engine, typeId, flags); }
+		static R get(asIScriptContext *ctx, int, asDWORD) { return IntegralReturnGetter<sizeof(R)>::template get<R>(ctx); }
+	};
+
+	template <typename R>
+	struct ScriptReturnTraits<R, typename std::enable_if<std::is_enum<R>::value>::type>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags) { return ScriptArgTraits<R>::accepts(engine, typeId, flags); }
+		static R get(asIScriptContext *ctx, int, asDWORD) { return (R)ctx->GetReturnDWord(); }
+	};
+
+	template <>
+	struct ScriptReturnTraits<float>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags) { return ScriptArgTraits<float>::accepts(engine, typeId, flags); }
+		static float get(asIScriptContext *ctx, int, asDWORD) { return ctx->GetReturnFloat(); }
+	};
+
+	template <>
+	struct ScriptReturnTraits<double>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags) { return ScriptArgTraits<double>::accepts(engine, typeId, flags); }
+		static double get(asIScriptContext *ctx, int, asDWORD) { return ctx->GetReturnDouble(); }
+	};
+
+	//! Object returns (handles / by value) come from GetReturnObject(), references to primitives from GetReturnAddress()
+	template <typename R>
+	struct ScriptReturnTraits<R*>
+	{
+		static bool accepts(asIScriptEngine *engine, int typeId, asDWORD flags)
+		{
+			if (!PointeeTraits<typename std::remove_cv<R>::type>::accepts(engine, typeId))
+				return false;
+			// Primitives returned by value have no address
+			return is_object_typeid(typeId) || (flags & asTM_INOUTREF) != 0;
+		}
+		static R* get(asIScriptContext *ctx, int typeId, asDWORD)
+		{
+			return static_cast<R*>(is_object_typeid(typeId) ? ctx->GetReturnObject() : ctx->GetReturnAddress());
+		}
+	};
+
+	//! Checks that a return value can still be used after the context is unprepared
+	/*!
+	* For callers that give their context back before returning (SharedCaller,
+	* AsyncCaller, ScriptObjectWrapper). Handles and objects returned by value
+	* belong to the context, so they're released with it - a pointer to one
+	* would dangle; ScriptHandle<T> (or R, for value types) should be used.
+	* References (to primitives or objects) refer to the script's own data, so
+	* they're fine.
+	*/
+	template <typename R>
+	struct DetachedReturn
+	{
+		static bool accepts(int, asDWORD) { return true; }
+	};
+
+	template <typename R>
+	struct DetachedReturn<R*>
+	{
+		static bool accepts(int typeId, asDWORD flags)
+		{
+			return !is_object_typeid(typeId) || (flags & asTM_INOUTREF) != 0;
+		}
+	};
+
+	//! Strips references and cv-qualifiers, to find the traits for a param type
+	template <typename T>
+	struct bare_type
+	{
+		typedef typename std::remove_cv<typename std::remove_reference<T>::type>::type type;
+	};
+
+	//! Whether an arg of C++ type T can be given to a param the script writes to (see is_writable_ref())
+	/*!
+	* Objects need a non-const reference or pointer, primitives a non-const
+	* pointer; anything else would have the script write into a const object
+	* or a temporary.
+	*/
+	template <typename T>
+	struct WritableArg
+	{
+		static bool accepts(int typeId)
+		{
+			typedef typename std::remove_reference<T>::type referred_type;
+			if (std::is_pointer<referred_type>::value)
+				return !std::is_const<typename std::remove_pointer<referred_type>::type>::value;
+			return is_object_typeid(typeId) && std::is_lvalue_reference<T>::value && !std::is_const<referred_type>::value;
+		}
+	};
+
+	//! Calls ScriptArgTraits<T>::set(), passing the bound mode to the ones for class types
+	template <typename T, bool IsClass = std::is_class<T>::value>
+	struct ArgSetter
+	{
+		static void set(asIScriptContext *ctx, asUINT arg, const T &t, const int *, const ObjectArgMode *, ArgCopies &)
+		{
+			ScriptArgTraits<T>::set(ctx, arg, t);
+		}
+	};
+
+	//! Pointer args also need the bound type-id and mode, to tell handles from references (see ScriptArgTraits<T*>)
+	template <typename T>
+	struct ArgSetter<T*, false>
+	{
+		static void set(asIScriptContext *ctx, asUINT arg, T *t, const int *typeIds, const ObjectArgMode *modes, ArgCopies &copies)
+		{
+			ScriptArgTraits<T*>::set(ctx, arg, t, typeIds[arg], modes[arg], copies);
+		}
+	};
+
+	template <typename T>
+	struct ArgSetter<T, true>
+	{
+		static void set(asIScriptContext *ctx, asUINT arg, const T &t, const int *typeIds, const ObjectArgMode *modes, ArgCopies &copies)
+		{
+			ScriptArgTraits<T>::set(ctx, arg, t, typeIds[arg], modes[arg], copies);
+		}
+	};
+
+	template <typename Signature>
+	struct SignatureTraits;
+
+	//! Checks script functions against a C++ signature, and sets args for it
+	/*!
+	* Used by TypedCaller (and the other callers with a fixed signature) to do
+	* all the type checking when a function is bound, so that set_args() can
+	* be used for every call without any checks.
+	*/
+	template <typename R, typename... Args>
+	struct SignatureTraits<R (Args...)>
+	{
+		//! Returns true if the params and return type of the function are compatible with R (Args...)
+		/*!
+		* \param[out] error
+		* If not null, set to a description of the mismatch when false is returned.
+		*/
+		static bool matches(asIScriptFunction *function, std::string *error = nullptr)
+		{
+			asIScriptEngine *engine = function->GetEngine();
+
+			if (function->GetParamCount() != sizeof...(Args))
+			{
+				if (error != nullptr)
+				{
+					std::ostringstream stream;
+					stream << function->GetDeclaration() << " takes " << function->GetParamCount()
+						<< " arguments, but the C++ signature has " << sizeof...(Args);
+					*error = stream.str();
+				}
+				return false;
+			}
+
+			asDWORD returnFlags = 0;
+			int returnTypeId = function->GetReturnTypeId(&returnFlags);
+			if (!ScriptReturnTraits<R>::accepts(engine, returnTypeId, returnFlags))
+			{
+				if (error != nullptr)
+					*error = std::string("the return type of ") + function->GetDeclaration() +
+						" isn't compatible with '" + typeid(R).name() + "'";
+				return false;
+			}
+
+			// Pack expansions in a braced-init-list are evaluated in order, so arg counts up from 0
+			asUINT arg = 0;
+			bool ok = true;
+			const bool expand[] = { true, (ok = ok && check_arg<Args>(engine, function, arg++, error))... };
+			(void)expand;
+			return ok;
+		}
+
+		//! The type-ids of a function's params, and how each object arg is passed
+		/*!
+		* The type-ids keep their handle flag, so pointer args to handle params
+		* can be passed with SetArgObject().
+		*/
+		struct bound_args
+		{
+			int typeIds[sizeof...(Args) + 1];
+			ObjectArgMode modes[sizeof...(Args) + 1];
+		};
+
+		//! Works out how each arg is passed to the (matching) function
+		/*!
+		* \param[in] mode_fn
+		* Picks the mode for each param (see object_arg_mode()).
+		*/
+		static bound_args bind_args(asIScriptFunction *function, ObjectArgMode (*mode_fn)(int, asDWORD) = &object_arg_mode)
+		{
+			bound_args bound;
+			for (asUINT arg = 0; arg < sizeof...(Args); ++arg)
+			{
+				asDWORD flags = 0;
+				bound.typeIds[arg] = function->GetParamTypeId(arg, &flags);
+				bound.modes[arg] = mode_fn(bound.typeIds[arg], flags);
+			}
+			bound.typeIds[sizeof...(Args)] = asTYPEID_VOID;
+			bound.modes[sizeof...(Args)] = ArgByObject;
+			return bound;
+		}
+
+		//! Sets the args on a prepared context, without checking them
+		/*!
+		* Args are passed by reference, so nothing is copied unless the param
+		* needs it (see ObjectArgMode); such copies are kept in copies.
+		*/
+		static void set_args(asIScriptContext *ctx, const bound_args &bound, ArgCopies &copies, const typename bare_type<Args>::type&... args)
+		{
+			asUINT arg = 0;
+			const int expand[] = { 0, (ArgSetter<typename bare_type<Args>::type>::set(ctx, arg, args, bound.typeIds, bound.modes, copies), ++arg, 0)... };
+			(void)expand;
+			(void)ctx;
+			(void)bound;
+			(void)copies;
+		}
+
+	private:
+		template <typename T>
+		static bool check_arg(asIScriptEngine *engine, asIScriptFunction *function, asUINT arg, std::string *error)
+		{
+			typedef typename bare_type<T>::type arg_type;
+
+			asDWORD flags = 0;
+			int typeId = function->GetParamTypeId(arg, &flags);
+			if (is_writable_ref(flags) && !WritableArg<T>::accepts(typeId))
+			{
+				if (error != nullptr)
+				{
+					std::ostringstream stream;
+					stream << "argument " << arg << " of " << function->GetDeclaration()
+						<< " is written to by the script, so it must be a non-const reference or pointer, not '" << typeid(T).name() << "'";
+					*error = stream.str();
+				}
+				return false;
+			}
+			if (!ScriptArgTraits<arg_type>::accepts(engine, typeId, flags))
+			{
+				if (error != nullptr)
+				{
+					std::ostringstream stream;
+					stream << "argument " << arg << " of " << function->GetDeclaration()
+						<< " isn't compatible with '" << typeid(arg_type).name() << "'";
+					*error = stream.str();
+				}
+				return false;
+			}
+			return true;
+		}
+	};
+
+	//! Wraps a script function's return value in an Expected (see TypedCaller#try_call())
+	template <typename R>
+	struct ExpectedReturn
+	{
+		static Expected<R> get(asIScriptContext *ctx, int typeId, asDWORD flags)
+		{
+			return Expected<R>(ScriptReturnTraits<R>::get(ctx, typeId, flags));
+		}
+	};
+
+	template <>
+	struct ExpectedReturn<void>
+	{
+		static Expected<void> get(asIScriptContext *, int, asDWORD)
+		{
+			return Expected<void>();
+		}
+	};
+
+	template <typename Signature>
+	class TypedCaller;
+
+	//! A Caller with a fixed C++ signature, checked against the script function once
+	/*!
+	* The parameter and return types of the script function are checked against
+	* <code>R (Args...)</code> when the caller is bound; if they don't match an
+	* Exception is thrown then. Calls set the args directly (see ScriptArgTraits)
+	* without the per-argument checking that Caller#call() does.
+	*
+	* \code
+	* TypedCaller<int (int, float)> fn = TypedCaller<int (int, float)>::Create(module, "int f(int, float)");
+	* int r = fn(1, 2.f);
+	* \endcode
+	*
+	* If the function can't be found the caller is simply not ok (like Caller),
+	* so check it with is_ok() / operator bool; calling it throws (try_call()
+	* returns a ScriptError instead).
+	*/
+	template <typename R, typename... Args>
+	class TypedCaller<R (Args...)> : public CallerBase
+	{
+		typedef void (TypedCaller::*safe_bool)() const;
+		void this_type_does_not_support_comparisons() const {}
+	public:
+		//! Default constructor
+		TypedCaller()
+			: CallerBase(),
+			_returnTypeId(asTYPEID_VOID),
+			_returnFlags(0)
+		{}
+
+		//! Constructor for object methods - borrows a context from the engine's ContextPool
+		TypedCaller(asIScriptEngine *engine, asIScriptObject *obj, asIScriptFunction* function)
+			: CallerBase(engine, obj, function),
+			_returnTypeId(asTYPEID_VOID),
+			_returnFlags(0)
+		{
+			bind(function);
+		}
+
+		//! Constructor - borrows a context from the engine's ContextPool
+		TypedCaller(asIScriptEngine *engine, asIScriptFunction* function)
+			: CallerBase(engine, function),
+			_returnTypeId(asTYPEID_VOID),
+			_returnFlags(0)
+		{
+			bind(function);
+		}
+
+		//! Constructor for object methods
+		TypedCaller(asIScriptContext *context, asIScriptObject *obj, asIScriptFunction* function)
+			: CallerBase(context, obj, function),
+			_returnTypeId(asTYPEID_VOID),
+			_returnFlags(0)
+		{
+			bind(function);
+		}
+
+		//! Constructor
+		TypedCaller(asIScriptContext *context, asIScriptFunction* function)
+			: CallerBase(context, function),
+			_returnTypeId(asTYPEID_VOID),
+			_returnFlags(0)
+		{
+			bind(function);
+		}
+
+		//! Creates a caller for a global method
+		static TypedCaller Create(asIScriptEngine *engine, const std::string& method_decl)
+		{
+			return TypedCaller(engine, engine->GetGlobalFunctionByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for a global method
+		static TypedCaller Create(asIScriptModule *module, const std::string& method_decl)
+		{
+			return TypedCaller(module->GetEngine(), module->GetFunctionByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for an object method
+		static TypedCaller Create(asIScriptObject *object, const std::string& method_decl)
+		{
+			auto type = object->GetObjectType();
+			return TypedCaller(type->GetEngine(), object, type->GetMethodByDecl(method_decl.c_str()));
+		}
+
+		//! Creates a caller for a global fn. for which the ID is known
+		static TypedCaller CallerForGlobalFuncId(asIScriptEngine *engine, int funcId)
+		{
+			return TypedCaller(engine, engine->GetFunctionById(funcId));
+		}
+
+		//! Creates a caller for an object method for which the ID is known
+		static TypedCaller CallerForMethodFuncId(asIScriptObject *obj, int funcId)
+		{
+			return TypedCaller(obj->GetEngine(), obj, obj->GetEngine()->GetFunctionById(funcId));
+		}
+
+		operator safe_bool() const
+		{
+			return is_ok() ? &TypedCaller::this_type_does_not_support_comparisons : 0;
+		}
+
+		//! Calls the function
+		/*!
+		* Throws an Exception if the call doesn't finish (a script exception,
+		* suspend or abort), whatever throwOnException is set to.
+		*/
+		R operator()(Args... args)
+		{
+			refresh_or_throw();
+			signature_traits::set_args(get_ctx(), _boundArgs, arg_copies(), args...);
+			execute_or_throw();
+			return ScriptReturnTraits<R>::get(get_ctx(), _returnTypeId, _returnFlags);
+		}
+
+		//! Calls the function (same as operator())
+		R call(Args... args)
+		{
+			return (*this)(args...);
+		}
+
+		//! Calls the function, moving the result into out
+		/*!
+		* Lets a value that's used for every call (e.g. a std::string or
+		* std::vector) keep its storage, rather than returning a new one.
+		* (A template so that it isn't declared for functions returning void.)
+		*/
+		template <typename Out>
+		void call_into(Out &out, Args... args)
+		{
+			refresh_or_throw();
+			signature_traits::set_args(get_ctx(), _boundArgs, arg_copies(), args...);
+			execute_or_throw();
+			out = ScriptReturnTraits<R>::get(get_ctx(), _returnTypeId, _returnFlags);
+		}
+
+		//! Calls the function, constructing the result in the given (uninitialised) storage
+		/*!
+		* \returns
+		* The constructed object, which the caller is responsible for destroying.
+		*/
+		R *call_in_place(void *storage, Args... args)
+		{
+			refresh_or_throw();
+			signature_traits::set_args(get_ctx(), _boundArgs, arg_copies(), args...);
+			execute_or_throw();
+			return new (storage) R(ScriptReturnTraits<R>::get(get_ctx(), _returnTypeId, _returnFlags));
+		}
+
+		//! Calls the function without throwing
+		/*!
+		* Failures (including script exceptions) are returned as a ScriptError,
+		* which doesn't allocate unless its message is asked for.
+		*
+		* \code
+		* Expected<int> r = fn.try_call(1, 2.f);
+		* if (r)
+		* 	use(*r);
+		* else if (r.error().code() == ScriptError::ScriptException)
+		* 	log(r.error().message());
+		* \endcode
+		*/
+		Expected<R> try_call(Args... args)
+		{
+			if (!refresh())
+				return ScriptError(ScriptError::NotPrepared, asCONTEXT_NOT_PREPARED, get_func());
+			signature_traits::set_args(get_ctx(), _boundArgs, arg_copies(), args...);
+
+			int r = try_execute();
+			if (r != asEXECUTION_FINISHED)
+				return ScriptError::FromExecuteResult(r, get_func(), get_ctx());
+			return ExpectedReturn<R>::get(get_ctx(), _returnTypeId, _returnFlags);
+		}
+
+	private:
+		typedef SignatureTraits<R (Args...)> signature_traits;
+
+		//! Prepares the context for a call, throwing if the caller isn't valid (e.g. the function wasn't found)
+		void refresh_or_throw()
+		{
+			if (!refresh() || get_ctx() == nullptr)
+				throw Exception("Can't call " + get_declaration() + " - TypedCaller is not valid");
+		}
+
+		//! Executes the call, throwing unless it finished (otherwise there's no return value to read)
+		void execute_or_throw()
+		{
+			int r = try_execute();
+			if (r != asEXECUTION_FINISHED)
+				throw Exception(ScriptError::FromExecuteResult(r, get_func(), get_ctx()).message());
+		}
+
+		//! Checks the signature of the script function against R (Args...)
+		void bind(asIScriptFunction *function)
+		{
+			if (function == nullptr)
+				return;
+
+			std::string error;
+			if (!signature_traits::matches(function, &error))
+				throw Exception("TypedCaller: " + error);
+
+			_returnTypeId = function->GetReturnTypeId(&_returnFlags);
+			_boundArgs = signature_traits::bind_args(function);
+		}
+
+		int _returnTypeId;
+		asDWORD _returnFlags;
+		typename signature_traits::bound_args _boundArgs;
+	};
+
+}}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_BYTECODESTREAM
+#define H_SCRIPTUTILS_BYTECODESTREAM
+
+#include <angelscript.h>
+
+#include "../Exception.h"
+
+#include <cstring>
+#include <vector>
+
+
+namespace ScriptUtils
+{
+
+	//! An in-memory asIBinaryStream, for saving / loading module bytecode
+	/*!
+	* A default-constructed stream collects what's written to it (e.g. by
+	* asIScriptModule#SaveByteCode()) in buffer(), and can then be read back.
+	* A stream constructed on existing data reads it in place, without
+	* copying (so the data must outlive the stream) - e.g. a byte array
+	* compiled into the application:
+	* \code
+	* ByteCodeStream stream(bytecode, sizeof(bytecode));
+	* module->LoadByteCode(&stream);
+	* \endcode
+	*/
+	class ByteCodeStream : public asIBinaryStream
+	{
+	public:
+		ByteCodeStream()
+			: _data(nullptr), _size(0), _position(0), _external(false), _overrun(false)
+		{}
+
+		//! Constructor - reads the given data (which isn't copied)
+		ByteCodeStream(const void *data, size_t size)
+			: _data(static_cast<const unsigned char*>(data)), _size(size), _position(0), _external(true), _overrun(false)
+		{}
+
+		//! Appends to buffer() (throws if the stream was constructed on external data)
+		virtual void Write(const void *ptr, asUINT size)
+		{
+			if (_external)
+				throw Exception("ByteCodeStream: can't write to a stream of external data");
+			const unsigned char *bytes = static_cast<const unsigned char*>(ptr);
+			_buffer.insert(_buffer.end(), bytes, bytes + size);
+			_data = _buffer.empty() ? nullptr : &_buffer[0];
+			_size = _buffer.size();
+		}
+
+		//! Reads the next size bytes (if there aren't that many, the rest is zeroed and overrun() is set)
+		virtual void Read(void *ptr, asUINT size)
+		{
+			size_t available = _size - _position;
+			size_t count = size < available ? size_t(size) : available;
+			if (count > 0)
+				std::memcpy(ptr, _data + _position, count);
+			if (count < size)
+			{
+				std::memset(static_cast<unsigned char*>(ptr) + count, 0, size - count);
+				_overrun = true;
+			}
+			_position += count;
+		}
+
+		//! Starts reading from the beginning again
+		void rewind()
+		{
+			_position = 0;
+			_overrun = false;
+		}
+
+		//! Returns true if a Read() went past the end of the data
+		bool overrun() const { return _overrun; }
+
+		const unsigned char *data() const { return _data; }
+
+		size_t size() const { return _size; }
+
+		//! The data written to the stream
+		const std::vector<unsigned char> &buffer() const { return _buffer; }
+
+	private:
+		//! Prevent copying
+		ByteCodeStream(const ByteCodeStream &);
+		//! Prevent copying
+		ByteCodeStream & operator=(const ByteCodeStream &);
+
+		std::vector<unsigned char> _buffer;
+		const unsigned char *_data;
+		size_t _size;
+		size_t _position;
+		bool _external;
+		bool _overrun;
+	};
+
+}
+
+#endif
@@ -10,6 +10,11 @@
 #include <angelscript.h>
 #include <boost/signals2/signal.hpp>
 
+#include "../Exception.h"
+
+#include <string>
+#include <vector>
+
 
 namespace ScriptUtils
 {
@@ -34,12 +39,22 @@ namespace ScriptUtils
 
 			StringFactory,
 
-			Typedef
+			Typedef,
+
+			Funcdef,
+
+			//! Not a registration, but changes the namespace of the ones that follow
+			DefaultNamespace
 		};
 
 	public:
 		RegistrationEvent()
-			: event_type(None)
+			: behaviour(asBEHAVE_CONSTRUCT),
+			calling_convention(0),
+			flags(0),
+			value(0),
+			pointer(NULL),
+			event_type(None)
 		{}
 
 		static void ForGlobalFunction(RegistrationEvent &out, const std::string &decl, asSFuncPtr fn_ptr, asDWORD call_conv)
@@ -59,41 +74,405 @@ namespace ScriptUtils
 			out.calling_convention = call_conv;
 		}
 
+		static void ForGlobalProperty(RegistrationEvent &out, const std::string &decl, void *ptr)
+		{
+			out.event_type = GlobalProperty;
+			out.declaraion = decl;
+			out.pointer = ptr;
+		}
+
+		static void ForObjectType(RegistrationEvent &out, const std::string &name, int byte_size, asDWORD flags)
+		{
+			out.event_type = ObjectType;
+			out.object_type_name = name;
+			out.value = byte_size;
+			out.flags = flags;
+		}
+
+		static void ForObjectMethod(RegistrationEvent &out, const std::string &obj, const std::string &decl, asSFuncPtr fn_ptr, asDWORD call_conv)
+		{
+			out.event_type = ObjectMethod;
+			out.object_type_name = obj;
+			out.declaraion = decl;
+			out.function_ptr = fn_ptr;
+			out.calling_convention = call_conv;
+		}
+
+		static void ForObjectBehaviour(RegistrationEvent &out, const std::string &obj, asEBehaviours behave, const std::string &decl, asSFuncPtr fn_ptr, asDWORD call_conv)
+		{
+			out.event_type = ObjectBehaviour;
+			out.object_type_name = obj;
+			out.behaviour = behave;
+			out.declaraion = decl;
+			out.function_ptr = fn_ptr;
+			out.calling_convention = call_conv;
+		}
+
+		static void ForObjectProperty(RegistrationEvent &out, const std::string &obj, const std::string &decl, int byte_offset)
+		{
+			out.event_type = ObjectProperty;
+			out.object_type_name = obj;
+			out.declaraion = decl;
+			out.value = byte_offset;
+		}
+
+		static void ForInterface(RegistrationEvent &out, const std::string &name)
+		{
+			out.event_type = Interface;
+			out.object_type_name = name;
+		}
+
+		static void ForInterfaceMethod(RegistrationEvent &out, const std::string &iface, const std::string &decl)
+		{
+			out.event_type = InterfaceMethod;
+			out.object_type_name = iface;
+			out.declaraion = decl;
+		}
+
+		static void ForEnum(RegistrationEvent &out, const std::string &name)
+		{
+			out.event_type = Enum;
+			out.object_type_name = name;
+		}
+
+		static void ForEnumValue(RegistrationEvent &out, const std::string &enum_name, const std::string &value_name, int value)
+		{
+			out.event_type = EnumValue;
+			out.object_type_name = enum_name;
+			out.declaraion = value_name;
+			out.value = value;
+		}
+
+		static void ForStringFactory(RegistrationEvent &out, const std::string &datatype, asSFuncPtr fn_ptr, asDWORD call_conv)
+		{
+			out.event_type = StringFactory;
+			out.declaraion = datatype;
+			out.function_ptr = fn_ptr;
+			out.calling_convention = call_conv;
+		}
+
+		static void ForTypedef(RegistrationEvent &out, const std::string &type, const std::string &decl)
+		{
+			out.event_type = Typedef;
+			out.object_type_name = type;
+			out.declaraion = decl;
+		}
+
+		static void ForFuncdef(RegistrationEvent &out, const std::string &decl)
+		{
+			out.event_type = Funcdef;
+			out.declaraion = decl;
+		}
+
+		static void ForDefaultNamespace(RegistrationEvent &out, const std::string &name_space)
+		{
+			out.event_type = DefaultNamespace;
+			out.declaraion = name_space;
+		}
+
+		//! Makes the registration this event describes with the given engine
+		/*!
+		* \returns
+		* The result of the engine's RegisterX() fn.
+		*/
+		int Apply(asIScriptEngine *engine) const
+		{
+			switch (event_type)
+			{
+			case Enum:
+				return engine->RegisterEnum(object_type_name.c_str());
+			case Interface:
+				return engine->RegisterInterface(object_type_name.c_str());
+			case ObjectType:
+				return engine->RegisterObjectType(object_type_name.c_str(), value, flags);
+			case EnumValue:
+				return engine->RegisterEnumValue(object_type_name.c_str(), declaraion.c_str(), value);
+			case GlobalFunction:
+				return engine->RegisterGlobalFunction(declaraion.c_str(), function_ptr, calling_convention);
+			case GlobalBehaviour:
+				return engine->RegisterGlobalBehaviour(behaviour, declaraion.c_str(), function_ptr, calling_convention);
+			case GlobalProperty:
+				return engine->RegisterGlobalProperty(declaraion.c_str(), pointer);
+			case InterfaceMethod:
+				return engine->RegisterInterfaceMethod(object_type_name.c_str(), declaraion.c_str());
+			case ObjectMethod:
+				return engine->RegisterObjectMethod(object_type_name.c_str(), declaraion.c_str(), function_ptr, calling_convention);
+			case ObjectBehaviour:
+				return engine->RegisterObjectBehaviour(object_type_name.c_str(), behaviour, declaraion.c_str(), function_ptr, calling_convention);
+			case ObjectProperty:
+				return engine->RegisterObjectProperty(object_type_name.c_str(), declaraion.c_str(), value);
+			case StringFactory:
+				return engine->RegisterStringFactory(declaraion.c_str(), function_ptr, calling_convention);
+			case Typedef:
+				return engine->RegisterTypedef(object_type_name.c_str(), declaraion.c_str());
+			case Funcdef:
+				return engine->RegisterFuncdef(declaraion.c_str());
+			case DefaultNamespace:
+				return engine->SetDefaultNamespace(declaraion.c_str());
+			default:
+				return asINVALID_ARG;
+			}
+		}
+
 	public:
 		RegistrationEvent(const std::string &decl, asSFuncPtr fn_ptr, asDWORD call_conv)
-			: event_type(GlobalFunction),
+			: behaviour(asBEHAVE_CONSTRUCT),
 			declaraion(decl),
 			function_ptr(fn_ptr),
-			calling_convention(call_conv)
+			calling_convention(call_conv),
+			flags(0),
+			value(0),
+			pointer(NULL),
+			event_type(GlobalFunction)
 		{
 		}
 
 	public:
+		//! The object type, interface or enum the registration is for (or the type of a typedef)
 		std::string object_type_name;
 		asEBehaviours behaviour;
+		//! The declaration (or the name of an enum value, the datatype of a string factory or a namespace)
 		std::string declaraion;
 		asSFuncPtr function_ptr;
 		asDWORD calling_convention;
+		//! Object type flags
+		asDWORD flags;
+		//! Object type size, property offset or enum value
+		int value;
+		//! Global property address
+		void *pointer;
 
 		RegEventType event_type;
 
 	};
 
+	//! A record of registrations, which can be replayed to make the same registrations with another engine
+	/*!
+	* Fill one by passing it to Engine#RecordTo() while the application
+	* registers its types and functions, then use Replay() to configure
+	* further engines (e.g. one per worker thread) without running the
+	* application's registration code again.
+	* <p>
+	* Function pointers and property addresses are replayed as they are, so
+	* the engines share the same global properties.
+	* </p>
+	*/
+	class RegistrationJournal
+	{
+	public:
+		typedef std::vector<RegistrationEvent> event_list;
+
+		void Record(const RegistrationEvent &ev)
+		{
+			m_Events.push_back(ev);
+		}
+
+		//! Makes all the recorded registrations (in order) with the given engine
+		/*!
+		* Throws an Exception if any of them fail.
+		*/
+		void Replay(asIScriptEngine *engine) const
+		{
+			for (event_list::const_iterator it = m_Events.begin(), end = m_Events.end(); it != end; ++it)
+			{
+				if (it->Apply(engine) < 0)
+					throw Exception("RegistrationJournal: failed to replay registration of " + it->object_type_name + " " + it->declaraion);
+			}
+		}
+
+		const event_list &GetEvents() const { return m_Events; }
+
+		size_t GetCount() const { return m_Events.size(); }
+
+		void Clear() { m_Events.clear(); }
+
+	private:
+		event_list m_Events;
+	};
+
 	//! Wrapps the AngelScript engine with expanded C++ behaviour
+	/*!
+	* The RegisterX() methods match those of asIScriptEngine; each successful
+	* registration is announced with OnRegistered (and recorded, if a journal
+	* has been given to RecordTo()).
+	*/
 	class Engine
 	{
 	public:
 		Engine(asIScriptEngine *engine)
-			: m_Engine(engine)
+			: m_Engine(engine),
+			m_Journal(NULL)
+		{
+		}
+
+		asIScriptEngine *GetEngine() const { return m_Engine; }
+
+		//! Records the registrations made from now on to the given journal (pass NULL to stop recording)
+		void RecordTo(RegistrationJournal *journal)
+		{
+			m_Journal = journal;
+		}
+
+		//! Makes the registrations in the journal, as if the RegisterX() fns. had been called
+		/*!
+		* Listeners are notified as usual. To skip that (and this wrapper),
+		* use RegistrationJournal#Replay(). If this engine is recording to the
+		* journal being replayed, the replayed registrations aren't recorded
+		* again (they're already in it).
+		*/
+		void Replay(const RegistrationJournal &journal)
+		{
+			// Recording would also add to the list being iterated
+			struct pause_recording
+			{
+				RegistrationJournal *&journal;
+				RegistrationJournal *recording;
+				pause_recording(RegistrationJournal *&journal_, const RegistrationJournal *replaying)
+					: journal(journal_), recording(journal_)
+				{
+					if (journal == replaying)
+						journal = NULL;
+				}
+				~pause_recording() { journal = recording; }
+			} pause(m_Journal, &journal);
+
+			const RegistrationJournal::event_list &events = journal.GetEvents();
+			for (RegistrationJournal::event_list::const_iterator it = events.begin(), end = events.end(); it != end; ++it)
+			{
+				if (Register(*it) < 0)
+					throw Exception("Engine: failed to replay registration of " + it->object_type_name + " " + it->declaraion);
+			}
+		}
+
+		//! Makes the registration described by the event
+		int Register(const RegistrationEvent &ev)
+		{
+			int r = ev.Apply(m_Engine);
+			if (r >= 0)
+			{
+				if (m_Journal != NULL)
+					m_Journal->Record(ev);
+				if (ev.event_type == RegistrationEvent::GlobalFunction)
+					OnRegisteredGlobalFunction(ev);
+				OnRegistered(ev);
+			}
+			return r;
+		}
+
+		int RegisterGlobalFunction(const char *decl, const asSFuncPtr &fn, asDWORD call_conv)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForGlobalFunction(ev, decl, fn, call_conv);
+			return Register(ev);
+		}
+
+		int RegisterGlobalBehaviour(asEBehaviours behave, const char *decl, const asSFuncPtr &fn, asDWORD call_conv)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForGlobalBehaviour(ev, behave, decl, fn, call_conv);
+			return Register(ev);
+		}
+
+		int RegisterGlobalProperty(const char *decl, void *ptr)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForGlobalProperty(ev, decl, ptr);
+			return Register(ev);
+		}
+
+		int RegisterObjectType(const char *name, int byte_size, asDWORD flags)
 		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForObjectType(ev, name, byte_size, flags);
+			return Register(ev);
 		}
 
-		void RegisterGlobalFunction(const char *decl, asSFuncPtr fn, asDWORD call_conv);
+		int RegisterObjectMethod(const char *obj, const char *decl, const asSFuncPtr &fn, asDWORD call_conv)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForObjectMethod(ev, obj, decl, fn, call_conv);
+			return Register(ev);
+		}
+
+		int RegisterObjectBehaviour(const char *obj, asEBehaviours behave, const char *decl, const asSFuncPtr &fn, asDWORD call_conv)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForObjectBehaviour(ev, obj, behave, decl, fn, call_conv);
+			return Register(ev);
+		}
+
+		int RegisterObjectProperty(const char *obj, const char *decl, int byte_offset)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForObjectProperty(ev, obj, decl, byte_offset);
+			return Register(ev);
+		}
+
+		int RegisterInterface(const char *name)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForInterface(ev, name);
+			return Register(ev);
+		}
+
+		int RegisterInterfaceMethod(const char *iface, const char *decl)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForInterfaceMethod(ev, iface, decl);
+			return Register(ev);
+		}
+
+		int RegisterEnum(const char *type)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForEnum(ev, type);
+			return Register(ev);
+		}
+
+		int RegisterEnumValue(const char *type, const char *name, int value)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForEnumValue(ev, type, name, value);
+			return Register(ev);
+		}
+
+		int RegisterStringFactory(const char *datatype, const asSFuncPtr &fn, asDWORD call_conv)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForStringFactory(ev, datatype, fn, call_conv);
+			return Register(ev);
+		}
+
+		int RegisterTypedef(const char *type, const char *decl)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForTypedef(ev, type, decl);
+			return Register(ev);
+		}
+
+		int RegisterFuncdef(const char *decl)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForFuncdef(ev, decl);
+			return Register(ev);
+		}
+
+		//! Sets the namespace registrations are made in (recorded, so replays use the same namespaces)
+		int SetDefaultNamespace(const char *name_space)
+		{
+			RegistrationEvent ev;
+			RegistrationEvent::ForDefaultNamespace(ev, name_space);
+			return Register(ev);
+		}
 
+		//! Called for each GlobalFunction registration
 		boost::signals2::signal<void (const RegistrationEvent &)> OnRegisteredGlobalFunction;
+		//! Called for every registration
+		boost::signals2::signal<void (const RegistrationEvent &)> OnRegistered;
 
 	private:
 		asIScriptEngine *m_Engine;
+		RegistrationJournal *m_Journal;
 	};
 
 }
@@ -0,0 +1,285 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_MODULECACHE
+#define H_SCRIPTUTILS_MODULECACHE
+
+#include <angelscript.h>
+
+#include "ByteCodeStream.h"
+#include "SignatureHash.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+namespace ScriptUtils
+{
+
+	//! A named piece of script source, as passed to asIScriptModule#AddScriptSection()
+	struct ScriptSection
+	{
+		std::string name;
+		std::string code;
+		int lineOffset;
+
+		ScriptSection(const std::string &name_, const std::string &code_, int line_offset = 0)
+			: name(name_), code(code_), lineOffset(line_offset)
+		{}
+	};
+
+	//! Caches compiled modules as bytecode files, so they don't have to be compiled from source every run
+	/*!
+	* Each module is stored as <code>&lt;directory&gt;/&lt;module name&gt;.asbc</code>,
+	* along with a key made from the module's script sections and the
+	* signature of the engine's registered interface (see EngineSignature()).
+	* Build() loads the file if its key matches, and otherwise builds the
+	* module from source and rewrites the file. The cache is only ever an
+	* optimisation: if a file can't be read or written the module is simply
+	* built from source.
+	*
+	* \code
+	* ModuleCache cache("cache/scripts", engine);
+	* ModuleCache::section_list sections;
+	* sections.push_back(ScriptSection("main.as", LoadFile("main.as")));
+	* int r = cache.Build(engine->GetModule("main", asGM_ALWAYS_CREATE), sections);
+	* \endcode
+	*
+	* The directory must already exist. Create the cache after everything has
+	* been registered with the engine.
+	*/
+	class ModuleCache
+	{
+	public:
+		typedef std::vector<ScriptSection> section_list;
+
+		//! Constructor - uses the signature of the given engine's registered interface
+		ModuleCache(const std::string &directory, asIScriptEngine *engine)
+			: _directory(directory),
+			_signature(EngineSignature(engine)),
+			_stripDebugInfo(false)
+		{}
+
+		//! Constructor - uses the given signature (e.g. a hash of the application's version)
+		ModuleCache(const std::string &directory, std::uint64_t signature)
+			: _directory(directory),
+			_signature(signature),
+			_stripDebugInfo(false)
+		{}
+
+		//! Saved bytecode will be without debug info (smaller, but without line numbers for errors)
+		void SetStripDebugInfo(bool strip)
+		{
+			_stripDebugInfo = strip;
+		}
+
+		std::uint64_t GetSignature() const
+		{
+			return _signature;
+		}
+
+		//! Returns the key that the module built from the given sections is cached with
+		std::uint64_t GetKey(const section_list &sections) const
+		{
+			SignatureHash hash;
+			hash.add_value(std::int64_t(_signature));
+			hash.add_value(_stripDebugInfo ? 1 : 0);
+			for (section_list::const_iterator it = sections.begin(), end = sections.end(); it != end; ++it)
+			{
+				hash.add(it->name);
+				hash.add(it->code);
+				hash.add_value(it->lineOffset);
+			}
+			return hash.get();
+		}
+
+		//! Returns the path of the file the named module is cached in
+		std::string GetPath(const std::string &module_name) const
+		{
+			std::string fileName = module_name;
+			for (std::string::iterator it = fileName.begin(), end = fileName.end(); it != end; ++it)
+			{
+				const char c = *it;
+				if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.'))
+					*it = '_';
+			}
+			if (_directory.empty())
+				return fileName + ".asbc";
+			const char last = _directory[_directory.length() - 1];
+			return _directory + (last == '/' || last == '\\' ? "" : "/") + fileName + ".asbc";
+		}
+
+		//! Loads the module from the cache if it's up to date, otherwise builds it from the sections (and caches it)
+		/*!
+		* \param[out] from_cache
+		* If not null, set to true if the module was loaded from the cache.
+		*
+		* \returns
+		* asSUCCESS, or the error returned by AddScriptSection() / Build().
+		*/
+		int Build(asIScriptModule *module, const section_list &sections, bool *from_cache = nullptr)
+		{
+			const std::uint64_t key = GetKey(sections);
+
+			if (from_cache != nullptr)
+				*from_cache = false;
+			if (Load(module, key))
+			{
+				if (from_cache != nullptr)
+					*from_cache = true;
+				return asSUCCESS;
+			}
+
+			for (section_list::const_iterator it = sections.begin(), end = sections.end(); it != end; ++it)
+			{
+				int r = module->AddScriptSection(it->name.c_str(), it->code.c_str(), it->code.length(), it->lineOffset);
+				if (r < 0)
+					return r;
+			}
+			int r = module->Build();
+			if (r < 0)
+				return r;
+
+			Save(module, key);
+			return r;
+		}
+
+		//! Loads the module from its cache file, if the file's key matches
+		bool Load(asIScriptModule *module, std::uint64_t key) const
+		{
+			std::ifstream file(GetPath(module->GetName()).c_str(), std::ios::in | std::ios::binary);
+			if (!file)
+				return false;
+
+			char magic[4];
+			std::uint64_t fileKey = 0;
+			file.read(magic, sizeof(magic));
+			file.read(reinterpret_cast<char*>(&fileKey), sizeof(fileKey));
+			if (!file || std::string(magic, sizeof(magic)) != file_magic() || fileKey != key)
+				return false;
+
+			std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			if (data.empty())
+				return false;
+
+			ByteCodeStream stream(&data[0], data.size());
+			return module->LoadByteCode(&stream) >= 0 && !stream.overrun();
+		}
+
+		//! Writes the module's bytecode to its cache file, with the given key
+		bool Save(asIScriptModule *module, std::uint64_t key) const
+		{
+			ByteCodeStream stream;
+			if (module->SaveByteCode(&stream, _stripDebugInfo) < 0 || stream.size() == 0)
+				return false;
+
+			// Written to a temporary file first, so a file that's being read is never partly written
+			const std::string path = GetPath(module->GetName());
+			const std::string tempPath = path + ".tmp";
+			{
+				std::ofstream file(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+				if (!file)
+					return false;
+				file.write(file_magic(), 4);
+				file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+				file.write(reinterpret_cast<const char*>(stream.data()), stream.size());
+				if (!file)
+				{
+					file.close();
+					std::remove(tempPath.c_str());
+					return false;
+				}
+			}
+			std::remove(path.c_str());
+			return std::rename(tempPath.c_str(), path.c_str()) == 0;
+		}
+
+		//! Returns a hash of everything registered with the engine that scripts can use
+		/*!
+		* Bytecode refers to registered functions and types by declaration, so
+		* when this changes modules have to be rebuilt from source. It includes
+		* the AngelScript version, since the bytecode format can change with it.
+		*/
+		static std::uint64_t EngineSignature(asIScriptEngine *engine)
+		{
+			SignatureHash hash;
+			hash.add_value(ANGELSCRIPT_VERSION);
+
+			for (asUINT i = 0, count = engine->GetGlobalFunctionCount(); i < count; ++i)
+				hash.add(engine->GetGlobalFunctionByIndex(i)->GetDeclaration(true, true));
+
+			for (asUINT i = 0, count = engine->GetGlobalPropertyCount(); i < count; ++i)
+			{
+				const char *name = nullptr, *nameSpace = nullptr;
+				int typeId = 0;
+				bool isConst = false;
+				engine->GetGlobalPropertyByIndex(i, &name, &nameSpace, &typeId, &isConst);
+				hash.add(nameSpace).add(name).add(engine->GetTypeDeclaration(typeId, true)).add_value(isConst ? 1 : 0);
+			}
+
+			for (asUINT i = 0, count = engine->GetObjectTypeCount(); i < count; ++i)
+			{
+				asIObjectType *type = engine->GetObjectTypeByIndex(i);
+				hash.add(type->GetNamespace()).add(type->GetName());
+				hash.add_value(type->GetFlags()).add_value(type->GetSize());
+				for (asUINT j = 0; j < type->GetFactoryCount(); ++j)
+					hash.add(type->GetFactoryByIndex(j)->GetDeclaration(true, true));
+				for (asUINT j = 0; j < type->GetBehaviourCount(); ++j)
+				{
+					asEBehaviours behaviour;
+					asIScriptFunction *function = type->GetBehaviourByIndex(j, &behaviour);
+					hash.add_value(behaviour).add(function != nullptr ? function->GetDeclaration(true, true) : "");
+				}
+				for (asUINT j = 0; j < type->GetMethodCount(); ++j)
+					hash.add(type->GetMethodByIndex(j)->GetDeclaration(true, true));
+				for (asUINT j = 0; j < type->GetPropertyCount(); ++j)
+					hash.add(type->GetPropertyDeclaration(j, true));
+			}
+
+			for (asUINT i = 0, count = engine->GetEnumCount(); i < count; ++i)
+			{
+				int enumTypeId = 0;
+				const char *nameSpace = nullptr;
+				hash.add(engine->GetEnumByIndex(i, &enumTypeId, &nameSpace)).add(nameSpace);
+				for (int j = 0, values = engine->GetEnumValueCount(enumTypeId); j < values; ++j)
+				{
+					int value = 0;
+					hash.add(engine->GetEnumValueByIndex(enumTypeId, j, &value)).add_value(value);
+				}
+			}
+
+			for (asUINT i = 0, count = engine->GetTypedefCount(); i < count; ++i)
+			{
+				int typeId = 0;
+				const char *nameSpace = nullptr;
+				hash.add(engine->GetTypedefByIndex(i, &typeId, &nameSpace)).add(nameSpace);
+				hash.add(engine->GetTypeDeclaration(typeId, true));
+			}
+
+			for (asUINT i = 0, count = engine->GetFuncdefCount(); i < count; ++i)
+				hash.add(engine->GetFuncdefByIndex(i)->GetDeclaration(true, true));
+
+			return hash.get();
+		}
+
+	private:
+		static const char *file_magic()
+		{
+			return "ASBC";
+		}
+
+		std::string _directory;
+		std::uint64_t _signature;
+		bool _stripDebugInfo;
+	};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SIGNATUREHASH
+#define H_SCRIPTUTILS_SIGNATUREHASH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace ScriptUtils
+{
+
+	//! A 64-bit FNV-1a hash, used to tell whether cached / generated output is out of date
+	/*!
+	* Strings are hashed with their length, so that <code>add("ab").add("c")</code>
+	* and <code>add("a").add("bc")</code> give different hashes. Values are
+	* hashed in the machine's byte order, so hashes shouldn't be compared
+	* between platforms.
+	*/
+	class SignatureHash
+	{
+	public:
+		SignatureHash()
+			: _hash(14695981039346656037ull)
+		{}
+
+		SignatureHash &add_bytes(const void *data, size_t length)
+		{
+			const unsigned char *bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < length; ++i)
+				_hash = (_hash ^ bytes[i]) * 1099511628211ull;
+			return *this;
+		}
+
+		SignatureHash &add_value(std::int64_t value)
+		{
+			return add_bytes(&value, sizeof(value));
+		}
+
+		SignatureHash &add(const std::string &str)
+		{
+			add_value(std::int64_t(str.length()));
+			return add_bytes(str.data(), str.length());
+		}
+
+		//! Adds a string (null is hashed as an empty string)
+		SignatureHash &add(const char *str)
+		{
+			return add(std::string(str != nullptr ? str : ""));
+		}
+
+		std::uint64_t get() const
+		{
+			return _hash;
+		}
+
+		//! Returns the hash as 16 hex digits
+		std::string hex() const
+		{
+			static const char digits[] = "0123456789abcdef";
+			std::string out(16, '0');
+			for (size_t i = 0; i < 16; ++i)
+				out[i] = digits[(_hash >> (60 - i * 4)) & 0xF];
+			return out;
+		}
+
+	private:
+		std::uint64_t _hash;
+	};
+
+}
+
+#endif
@@ -9,48 +9,256 @@
 
 #include <angelscript.h>
 
-#include <unordered_map>
+#include "../Exception.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <typeinfo>
 
 
 namespace ScriptUtils
 {
 
-	struct TypeRegistry
+	//! An array that can be read without locking while it's written to
+	/*!
+	* Entries are stored in fixed-size chunks, allocated as they're needed and
+	* never moved, so readers only see a chunk once it's complete. Writers must
+	* be serialised by the owner. Empty entries read as V().
+	*/
+	template <typename V>
+	class ChunkedTable
+	{
+	public:
+		static const size_t chunk_size = 256;
+		static const size_t max_chunks = 1024;
+
+		ChunkedTable()
+		{
+			for (size_t i = 0; i < max_chunks; ++i)
+				_chunks[i].store(nullptr, std::memory_order_relaxed);
+		}
+
+		~ChunkedTable()
+		{
+			for (size_t i = 0; i < max_chunks; ++i)
+				delete[] _chunks[i].load(std::memory_order_relaxed);
+		}
+
+		V get(size_t index) const
+		{
+			if (index >= chunk_size * max_chunks)
+				return V();
+			const std::atomic<V> *chunk = _chunks[index / chunk_size].load(std::memory_order_acquire);
+			return chunk != nullptr ? chunk[index % chunk_size].load(std::memory_order_acquire) : V();
+		}
+
+		//! Sets an entry (calls must be serialised)
+		void set(size_t index, V value)
+		{
+			if (index >= chunk_size * max_chunks)
+				throw Exception("ChunkedTable: index out of range");
+			std::atomic<V> *chunk = _chunks[index / chunk_size].load(std::memory_order_relaxed);
+			if (chunk == nullptr)
+			{
+				chunk = new std::atomic<V>[chunk_size];
+				for (size_t i = 0; i < chunk_size; ++i)
+					chunk[i].store(V(), std::memory_order_relaxed);
+				_chunks[index / chunk_size].store(chunk, std::memory_order_release);
+			}
+			chunk[index % chunk_size].store(value, std::memory_order_release);
+		}
+
+	private:
+		//! Prevent copying
+		ChunkedTable(const ChunkedTable &);
+		//! Prevent copying
+		ChunkedTable & operator=(const ChunkedTable &);
+
+		std::atomic<std::atomic<V>*> _chunks[max_chunks];
+	};
+
+	//! Gives each C++ type a dense index, used to look it up in a TypeRegistry
+	/*!
+	* Indices are handed out the first time each type's index() is called, so
+	* they only depend on the order types are first used in (they're not
+	* stable between runs).
+	*/
+	class TypeSlots
+	{
+	public:
+		static const size_t npos = ~size_t(0);
+
+		//! Returns the type a slot was given to (null if it hasn't been)
+		static const std::type_info *GetTypeInfo(size_t slot)
+		{
+			return table().get(slot);
+		}
+
+		//! Returns the number of slots handed out so far
+		static size_t GetCount()
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			return count();
+		}
+
+		static size_t allocate(const std::type_info &type)
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			size_t slot = count()++;
+			table().set(slot, &type);
+			return slot;
+		}
+
+	private:
+		static ChunkedTable<const std::type_info*> &table()
+		{
+			static ChunkedTable<const std::type_info*> types;
+			return types;
+		}
+
+		static size_t &count()
+		{
+			static size_t next = 0;
+			return next;
+		}
+
+		static std::mutex &mutex()
+		{
+			static std::mutex m;
+			return m;
+		}
+	};
+
+	//! The slot of a C++ type (see TypeSlots)
+	template <class T>
+	struct TypeSlot
+	{
+		static size_t index()
+		{
+			static const size_t slot = TypeSlots::allocate(typeid(T));
+			return slot;
+		}
+	};
+
+	//! Links C++ types to the script types they're registered as
+	/*!
+	* GetType<T>() is a load from an array indexed by T's TypeSlot, and the
+	* reverse (GetCppType()) one indexed by the script type-id, so neither
+	* locks: worker threads can look types up while (say) a module is being
+	* built. Registering takes a lock, so register the types up front -
+	* RegisterTypes() does a batch under one lock.
+	*
+	* \code
+	* registry.RegisterTypes<Vector2, Entity>(engine->GetTypeIdByDecl("Vector2"), engine->GetTypeIdByDecl("Entity"));
+	* int vecTypeId = registry.GetType<Vector2>();
+	* \endcode
+	*/
+	class TypeRegistry
 	{
-		typedef std::unordered_map<std::type_info, int> registry_type;
-		registry_type _Registry;
+		template <class T>
+		struct type_id_param { typedef int type; };
+
+	public:
+		TypeRegistry()
+		{}
 
+		//! Links the C++ class type to the given script type
+		/*!
+		* Replaces any previous registration of T, and of the script type (so
+		* each C++ type is linked to at most one script type and vice versa).
+		*/
 		template <class T>
 		void RegisterType(int typeId)
 		{
-			// Link the C++ class type to the given script type
-			_Registry.insert( registry_type::value_type(typeid(T), typeId) );
+			std::lock_guard<std::mutex> lock(_mutex);
+			link(TypeSlot<T>::index(), typeId);
 		}
 
+		//! Links each of the C++ types to the matching script type (in order)
+		template <class... Ts>
+		void RegisterTypes(typename type_id_param<Ts>::type... typeIds)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			const int expand[] = { 0, (link(TypeSlot<Ts>::index(), typeIds), 0)... };
+			(void)expand;
+		}
+
+		//! Returns the script type-id T is registered as, or -1 if it isn't registered
 		template <class T>
-		int GetType()
+		int GetType() const
 		{
-			registry_type::iterator _where = _Registry.find(typeid(t));
-			if (_where != _Registry.end())
-			{
-				return _where->second;
-			}
-			else
-				return -1;
+			return _typeIds.get(TypeSlot<T>::index()) - 1;
 		}
 
 		template <class T>
-		bool IsRegisteredAs(int typeId)
+		bool IsRegisteredAs(int typeId) const
 		{
-			registry_type::iterator _where = _Registry.find(typeid(t));
-			if (_where != _Registry.end())
-			{
-				return _where->second == typeId;
-			}
-			else
-				return false;
+			return typeId >= 0 && GetType<T>() == typeId;
+		}
+
+		//! Returns the C++ type registered as the given script type (null if none is)
+		const std::type_info *GetCppType(int typeId) const
+		{
+			size_t slot = GetSlot(typeId);
+			return slot != TypeSlots::npos ? TypeSlots::GetTypeInfo(slot) : nullptr;
+		}
+
+		//! Returns the TypeSlot of the C++ type registered as the given script type (TypeSlots::npos if none is)
+		/*!
+		* Handle flags are ignored: a handle to a type gives the C++ type that
+		* the type itself is registered as.
+		*/
+		size_t GetSlot(int typeId) const
+		{
+			if (typeId < 0)
+				return TypeSlots::npos;
+			size_t slot = _slots.get(sequence_number(typeId));
+			return slot != 0 ? slot - 1 : TypeSlots::npos;
+		}
+
+	private:
+		//! Prevent copying
+		TypeRegistry(const TypeRegistry &);
+		//! Prevent copying
+		TypeRegistry & operator=(const TypeRegistry &);
+
+		static size_t sequence_number(int typeId)
+		{
+			return size_t(typeId & asTYPEID_MASK_SEQNBR);
 		}
 
+		//! Links slot <-> typeId (the caller holds _mutex)
+		void link(size_t slot, int typeId)
+		{
+			if (typeId < 0)
+				throw Exception("TypeRegistry: can't register a C++ type as an invalid script type-id");
+			// The reverse table is keyed by sequence number, which a handle shares with its type
+			if ((typeId & (asTYPEID_OBJHANDLE | asTYPEID_HANDLETOCONST)) != 0)
+				throw Exception("TypeRegistry: can't register a C++ type as a handle type-id - register it as the type itself");
+
+			// Unlink the script type this C++ type was registered as before
+			int previous = _typeIds.get(slot) - 1;
+			if (previous >= 0 && _slots.get(sequence_number(previous)) == slot + 1)
+				_slots.set(sequence_number(previous), 0);
+
+			// ... and unlink the C++ type that was registered as this script type before
+			size_t owner = _slots.get(sequence_number(typeId));
+			if (owner != 0 && owner != slot + 1)
+				_typeIds.set(owner - 1, 0);
+
+			// Entries are stored +1, so that 0 means unregistered
+			_typeIds.set(slot, typeId + 1);
+			_slots.set(sequence_number(typeId), slot + 1);
+		}
+
+		//! Script type-id + 1, by TypeSlot
+		ChunkedTable<int> _typeIds;
+		//! TypeSlot + 1, by type-id sequence number
+		ChunkedTable<size_t> _slots;
+
+		//! Serialises registration
+		std::mutex _mutex;
 	};
 
 }
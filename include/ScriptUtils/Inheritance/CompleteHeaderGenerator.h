@@ -8,13 +8,35 @@
 #define H_SCRIPTUTILS_COMPLETEHEADERGENERATOR
 
 #include "ProxyGenerator.h"
+#include "../Engine/ByteCodeStream.h"
 
 #include <boost/algorithm/string.hpp>
 
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
 
 namespace ScriptUtils { namespace Inheritance
 {
 
+	//! Generates a header that adds the proxies to a module
+	/*!
+	* By default the header embeds the script source, and defines
+	* <code>int Add&lt;tag&gt;ScriptSection(asIScriptEngine*, const char *module_name)</code>
+	* to add it to a module (which is then compiled as usual).
+	* <p>
+	* Constructed with an engine, the proxies are compiled when the generator
+	* is finished with, and the header embeds the bytecode instead: it defines
+	* <code>int Load&lt;tag&gt;ByteCode(asIScriptEngine*, const char *module_name)</code>,
+	* which loads the module from memory (see ByteCodeStream) without parsing
+	* or compiling anything. The bytecode only loads into an engine with the
+	* same registered interface as the one it was compiled with (otherwise
+	* LoadByteCode() fails, and the error is returned), and it replaces
+	* anything already in the module. If the proxies don't compile, the
+	* header is written with an <code>\#error</code> saying why.
+	* </p>
+	*/
 	class CompleteHeaderGenerator : public ProxyGenerator
 	{
 	public:
@@ -26,7 +48,34 @@ namespace ScriptUtils { namespace Inheritance
 			const std::string &includes = "<angelscript.h>", const std::string &namespaces = "")
 			: ProxyGenerator(filename, std::ios::out, ProxyGenerator::cheader, true),
 			_tag(tag),
-			_namespaceCount(0)
+			_namespaceCount(0),
+			_byteCodeEngine(nullptr),
+			_stripDebugInfo(false)
+		{
+			init(includes, namespaces);
+		}
+
+		//! Constructor - the header will embed the proxies as bytecode, compiled with the given engine
+		/*!
+		* The generated script is written to <code>filename + ".as"</code>
+		* while the proxies are generated, then compiled to make the header.
+		*
+		* \param[in] strip_debug_info
+		* Leave out debug info (line numbers, etc.) to make the bytecode smaller.
+		*/
+		CompleteHeaderGenerator(asIScriptEngine *engine,
+			const std::string &filename,
+			const std::string &tag,
+			const std::string &includes = "<angelscript.h>", const std::string &namespaces = "",
+			bool strip_debug_info = false)
+			: ProxyGenerator(filename + ".as", std::ios::out, ProxyGenerator::script, true),
+			_tag(tag),
+			_namespaceCount(0),
+			_byteCodeEngine(engine),
+			_stripDebugInfo(strip_debug_info),
+			_filename(filename),
+			_includes(includes),
+			_namespaces(namespaces)
 		{
 			init(includes, namespaces);
 		}
@@ -38,36 +87,16 @@ namespace ScriptUtils { namespace Inheritance
 
 		virtual void init(const std::string &includes, const std::string &namespaces)
 		{
-			if (file)
+			if (_byteCodeEngine != nullptr)
 			{
-				file << "// This is a generated file\n" << std::endl;
-
-				// add include-once preprecessor stuff
-				file << "#ifndef H_SCRIPT_" << boost::to_upper_copy(_tag) << std::endl;
-				file << "#define H_SCRIPT_" << boost::to_upper_copy(_tag) << std::endl << std::endl;
-
-				// add namespaces
-				if (!includes.empty())
-				{
-					char_sep_tokenizer tokenizer(includes, char_sep_func(","));
-					for (char_sep_tokenizer::iterator tok = tokenizer.begin(); tok != tokenizer.end(); tok++)
-					{
-						file << "#include " << *tok;
-					}
-					file << std::endl << std::endl;
-				}
+				// The script itself is written as usual: the header is written in deinit()
+				ProxyGenerator::init();
+				return;
+			}
 
-				// add namespaces
-				if (!namespaces.empty())
-				{
-					char_sep_tokenizer tokenizer(namespaces, char_sep_func(","));
-					for (char_sep_tokenizer::iterator tok = tokenizer.begin(); tok != tokenizer.end(); tok++)
-					{
-						file << "namespace " << *tok << " { ";
-						_namespaceCount++; // Used to close all the namespace scopes in deinit()
-					}
-					file << std::endl;
-				}
+			if (file)
+			{
+				writeOpening(file, includes, namespaces);
 
 				// Define the function
 				file << "\tint Add"+_tag+"ScriptSection(asIScriptEngine *engine, const char *module_name)" << std::endl;
@@ -89,6 +118,12 @@ namespace ScriptUtils { namespace Inheritance
 			// Finish code generation
 			ProxyGenerator::deinit();
 
+			if (_byteCodeEngine != nullptr)
+			{
+				writeByteCodeHeader();
+				return;
+			}
+
 			if (file)
 			{
 				// Don't need to copy the script
@@ -100,15 +135,130 @@ namespace ScriptUtils { namespace Inheritance
 				file << "\t\tengine->SetEngineProperty(asEP_COPY_SCRIPT_SECTIONS, copy);" << std::endl;
 				file << "\t\treturn r;\n\t}" << std::endl;
 
-				for (unsigned int i = 0; i < _namespaceCount; i++)
-					file << "}";
+				writeClosing(file);
+			}
+		}
+
+	protected:
+		//! Writes the include guard, includes and opening namespace scopes
+		void writeOpening(std::ostream &out, const std::string &includes, const std::string &namespaces)
+		{
+			out << "// This is a generated file\n" << std::endl;
 
-				file << std::endl;
+			// add include-once preprecessor stuff
+			out << "#ifndef H_SCRIPT_" << boost::to_upper_copy(_tag) << std::endl;
+			out << "#define H_SCRIPT_" << boost::to_upper_copy(_tag) << std::endl << std::endl;
 
-				file << "\n#endif" << std::endl;
+			// add includes
+			if (!includes.empty())
+			{
+				char_sep_tokenizer tokenizer(includes, char_sep_func(","));
+				for (char_sep_tokenizer::iterator tok = tokenizer.begin(); tok != tokenizer.end(); tok++)
+				{
+					out << "#include " << *tok << std::endl;
+				}
+				out << std::endl;
 			}
+
+			// add namespaces
+			if (!namespaces.empty())
+			{
+				char_sep_tokenizer tokenizer(namespaces, char_sep_func(","));
+				for (char_sep_tokenizer::iterator tok = tokenizer.begin(); tok != tokenizer.end(); tok++)
+				{
+					out << "namespace " << *tok << " { ";
+					_namespaceCount++; // Used to close all the namespace scopes in writeClosing()
+				}
+				out << std::endl;
+			}
+		}
+
+		//! Closes the namespace scopes and the include guard
+		void writeClosing(std::ostream &out)
+		{
+			for (unsigned int i = 0; i < _namespaceCount; i++)
+				out << "}";
+
+			out << std::endl;
+
+			out << "\n#endif" << std::endl;
+		}
+
+		//! Compiles the generated script and writes the header with its bytecode
+		void writeByteCodeHeader()
+		{
+			if (!file.is_open())
+				return;
+			file.close();
+
+			const std::string scriptFilename = _filename + ".as";
+			std::string source;
+			{
+				std::ifstream scriptFile(scriptFilename.c_str(), std::ios::in | std::ios::binary);
+				source.assign((std::istreambuf_iterator<char>(scriptFile)), std::istreambuf_iterator<char>());
+			}
+
+			// Compiled in a temporary module
+			ByteCodeStream stream;
+			std::string error;
+			asIScriptModule *module = _byteCodeEngine->GetModule(("__" + _tag + "ByteCode").c_str(), asGM_ALWAYS_CREATE);
+			int r = module->AddScriptSection(_tag.c_str(), source.c_str(), source.length());
+			if (r < 0)
+				error = "failed to add the generated script";
+			else if ((r = module->Build()) < 0)
+				error = "the generated script (" + scriptFilename + ") didn't compile";
+			else if ((r = module->SaveByteCode(&stream, _stripDebugInfo)) < 0)
+				error = "failed to save the bytecode";
+			module->Discard();
+
+			std::ofstream header(_filename.c_str(), std::ios::out | std::ios::trunc);
+			if (!header)
+				return;
+
+			writeOpening(header, _includes + ",<ScriptUtils/Engine/ByteCodeStream.h>", _namespaces);
+			const std::string indent = _namespaces.empty() ? "" : "\t";
+
+			if (!error.empty())
+			{
+				// Keep the script, so it can be looked at
+				header << "#error " << _tag << ": " << error << std::endl;
+			}
+			else
+			{
+				header << indent << "const unsigned char " << _tag << "ByteCode[] =" << std::endl;
+				header << indent << "{" << std::endl;
+				static const char digits[] = "0123456789abcdef";
+				const size_t bytesPerLine = 16;
+				for (size_t i = 0; i < stream.size(); ++i)
+				{
+					const unsigned char byte = stream.data()[i];
+					if (i % bytesPerLine == 0)
+						header << indent << "\t";
+					header << "0x" << digits[byte >> 4] << digits[byte & 0xF] << ",";
+					header << (i % bytesPerLine == bytesPerLine - 1 || i + 1 == stream.size() ? "\n" : " ");
+				}
+				header << indent << "};" << std::endl << std::endl;
+
+				header << indent << "//! Loads the precompiled " << _tag << " proxies into the named module (replacing what's there)" << std::endl;
+				header << indent << "inline int Load" << _tag << "ByteCode(asIScriptEngine *engine, const char *module_name)" << std::endl;
+				header << indent << "{" << std::endl;
+				header << indent << "\tScriptUtils::ByteCodeStream stream(" << _tag << "ByteCode, sizeof(" << _tag << "ByteCode));" << std::endl;
+				header << indent << "\treturn engine->GetModule(module_name, asGM_CREATE_IF_NOT_EXISTS)->LoadByteCode(&stream);" << std::endl;
+				header << indent << "}" << std::endl;
+
+				std::remove(scriptFilename.c_str());
+			}
+
+			writeClosing(header);
 		}
 
+	private:
+		//! Set when generating bytecode
+		asIScriptEngine *_byteCodeEngine;
+		bool _stripDebugInfo;
+		std::string _filename;
+		std::string _includes;
+		std::string _namespaces;
 	};
 
 }}
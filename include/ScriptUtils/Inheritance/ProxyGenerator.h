@@ -9,12 +9,19 @@
 
 #include <angelscript.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <string>
 #include <fstream>
+#include <iterator>
 #include <sstream>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "../Exception.h"
+#include "../Engine/SignatureHash.h"
 
 #include <boost/lexical_cast.hpp>
 #include <boost/tokenizer.hpp>
@@ -79,7 +86,9 @@ namespace ScriptUtils { namespace Inheritance
 		enum OutputMode
 		{
 			script,
-			cheader
+			cheader,
+			//! C++ classes for calling script objects (see GenerateCppWrapper())
+			cppwrapper
 		};
 
 	protected:
@@ -109,19 +118,44 @@ namespace ScriptUtils { namespace Inheritance
 		* Sets when the start and end of the script data are added to the file: <br>
 		* false - during constructor/destructor<br>
 		* true - manually, by calling <code>init()</code> / <code>deinit()</code>
+		*
+		* \param[in] manifest_filename
+		* If given, the output is incremental: the file is only written if its
+		* content has changed, and types that haven't changed since the last
+		* run aren't generated again (their previous output is copied). The
+		* manifest records a hash of what each type was generated from (its
+		* method declarations, base, interfaces and the generator's settings)
+		* and where its output is in the file. The output is written to
+		* <code>filename + ".tmp"</code> until the generator is destroyed, and
+		* file_mode must not append.
 		*/
 		ProxyGenerator(const std::string &filename, std::ios_base::open_mode file_mode = std::ios::out,
 			OutputMode output_type = script, 
-			bool manual_init = false)
-			: file(filename.c_str(), file_mode),
+			bool manual_init = false,
+			const std::string &manifest_filename = "")
+			: file((manifest_filename.empty() ? filename : filename + ".tmp").c_str(),
+				manifest_filename.empty() ? std::ios_base::openmode(file_mode) : (std::ios::out | std::ios::binary | std::ios::trunc)),
 			_output_type(output_type),
 			_manual_init(manual_init),
 			_typePrefix("Script"),
 			_identPrefix("p"),
 			_innerPrefix("__inner"),
 			_outputIndent(""),
-			_baseCount(0)
+			_baseCount(0),
+			_outputFilename(filename),
+			_manifestFilename(manifest_filename)
 		{
+			_cppTypeNames["string"] = "std::string";
+			if (!_manifestFilename.empty())
+			{
+				if ((file_mode & std::ios::app) != 0)
+				{
+					file.close();
+					std::remove((_outputFilename + ".tmp").c_str());
+					throw Exception("ProxyGenerator: incremental output (with a manifest) can't be appended to an existing file");
+				}
+				loadManifest();
+			}
 			if (!_manual_init) init();
 		}
 
@@ -154,6 +188,7 @@ namespace ScriptUtils { namespace Inheritance
 		~ProxyGenerator()
 		{
 			if (!_manual_init) deinit();
+			commitOutput();
 		}
 
 		virtual void init()
@@ -172,6 +207,9 @@ namespace ScriptUtils { namespace Inheritance
 				_tab = "\t";
 				_emptyline = _linebegin + _lineend;
 			}
+
+			if (_output_type == cppwrapper && file)
+				file << "#include <ScriptUtils/Inheritance/ScriptObjectWrapper.h>" << _lineend << _lineend;
 		}
 
 		virtual void deinit()
@@ -237,6 +275,131 @@ namespace ScriptUtils { namespace Inheritance
 			return _outputIndent.length();
 		}
 
+		//! Sets the C++ type used for a registered type in the classes written by GenerateCppWrapper()
+		/*!
+		* Types that aren't given a name here keep their script name, except
+		* 'string', which is std::string by default.
+		*
+		* \param[in] script_name
+		* The name of a registered type (or enum - enums are int otherwise).
+		*/
+		void SetCppTypeName(const std::string &script_name, const std::string &cpp_name)
+		{
+			_cppTypeNames[script_name] = cpp_name;
+		}
+
+		//! Generates a C++ class for calling the methods of a script interface or class
+		/*!
+		* Only available in cppwrapper mode. The generated class derives from
+		* ScriptObjectWrapper and has a method for each of the type's methods,
+		* e.g. for
+		* \code
+		* interface IThing { void Update(float dt); int GetCount(); }
+		* \endcode
+		* it's something like
+		* \code
+		* class ScriptIThing : public ScriptUtils::Inheritance::ScriptObjectWrapper
+		* {
+		* public:
+		* 	explicit ScriptIThing(asIScriptObject *obj);
+		* 	void Update(float p1) { call_method<void>(_bound[0], p1); }
+		* 	int GetCount() { return call_method<int>(_bound[1]); }
+		* private:
+		* 	asIScriptFunction *_bound[2];
+		* };
+		* \endcode
+		* The methods are looked up once, when the object is wrapped (their
+		* declarations are hashed at compile time), so calls don't do any
+		* lookups. Wrapping an object that doesn't implement an interface
+		* throws; methods a wrapped class object doesn't have throw when called.
+		*
+		* \param[in] type
+		* A script interface or class.
+		*/
+		void GenerateCppWrapper(asIObjectType *type)
+		{
+			if (!file)
+				throw Exception("File not available - either the path doesn't exist or there was a write error.");
+			if (_output_type != cppwrapper)
+				throw Exception("ProxyGenerator::GenerateCppWrapper can only be used in cppwrapper mode");
+			if (type == NULL)
+				throw Exception("ProxyGenerator::GenerateCppWrapper: no type given");
+
+			_engine = type->GetEngine();
+
+			const std::string className = _typePrefix + type->GetName();
+			const bool isInterface = (type->GetFlags() & asOBJ_SCRIPT_OBJECT) != 0 && type->GetSize() == 0;
+			const int count = type->GetMethodCount();
+
+			const std::string outputKey = std::string("cppwrapper:") + type->GetName();
+			std::uint64_t outputHash = 0;
+			std::streamoff outputStart = 0;
+			if (isIncremental())
+			{
+				outputHash = cppWrapperHash(type, isInterface);
+				outputStart = file.tellp();
+				if (reuseOutput(outputKey, outputHash))
+				{
+					recordOutput(outputKey, outputHash, outputStart);
+					return;
+				}
+			}
+
+			file << _linebegin << "//! Calls the methods of script objects of type " << type->GetName() << " (generated by ProxyGenerator)" << _lineend;
+			file << _linebegin << "class " << className << " : public ScriptUtils::Inheritance::ScriptObjectWrapper" << _lineend;
+			file << _linebegin << "{" << _lineend;
+			file << _linebegin << "public:" << _lineend;
+
+			// Constructor - binds the methods
+			file << _linebegin << _tab << "explicit " << className << "(asIScriptObject *obj)" << _lineend;
+			file << _linebegin << _tab << _tab << ": ScriptUtils::Inheritance::ScriptObjectWrapper(obj";
+			if (isInterface)
+				file << ", \"" << type->GetName() << "\"";
+			file << ")" << _lineend;
+			file << _linebegin << _tab << "{" << _lineend;
+			if (count > 0)
+			{
+				file << _linebegin << _tab << _tab << "static const ScriptUtils::Inheritance::MethodKey decls[] = {" << _lineend;
+				for (int i = 0; i < count; ++i)
+				{
+					file << _linebegin << _tab << _tab << _tab << "\"" << type->GetMethodByIndex(i)->GetDeclaration(false) << "\"";
+					file << (i + 1 < count ? "," : "") << _lineend;
+				}
+				file << _linebegin << _tab << _tab << "};" << _lineend;
+				file << _linebegin << _tab << _tab << "bind_methods(decls, _bound, " << count << ");" << _lineend;
+			}
+			file << _linebegin << _tab << "}" << _lineend;
+
+			// Methods
+			if (count > 0)
+				file << _emptyline;
+			for (int i = 0; i < count; ++i)
+				writeCppMethod(type->GetMethodByIndex(i), i);
+
+			if (count > 0)
+			{
+				file << _emptyline;
+				file << _linebegin << "private:" << _lineend;
+				file << _linebegin << _tab << "asIScriptFunction *_bound[" << count << "];" << _lineend;
+			}
+			file << _linebegin << "};" << _lineend << _emptyline;
+
+			if (isIncremental())
+				recordOutput(outputKey, outputHash, outputStart);
+		}
+
+		//! Generates a C++ class for calling the methods of the named script interface or class
+		/*!
+		* \see GenerateCppWrapper(asIObjectType*)
+		*/
+		void GenerateCppWrapper(asIScriptModule *module, const char *type_name)
+		{
+			asIObjectType *type = module->GetEngine()->GetObjectTypeById(module->GetTypeIdByDecl(type_name));
+			if (type == NULL)
+				throw Exception(std::string(type_name) + " isn't a type in module " + module->GetName());
+			GenerateCppWrapper(type);
+		}
+
 		//! Generates a wrapper class to allow inheriting from the given application class
 		/*!
 		* Interfaces should be passed as a string containing a comma seperated list.
@@ -313,6 +476,24 @@ namespace ScriptUtils { namespace Inheritance
 			if (interface_names != NULL)
 				listInterfaces(ifaceTypeList, interface_names);
 
+			// Reuse the previous output for the class, if nothing it's generated from has changed
+			const std::string outputKey = std::string("proxy:") + type_name;
+			std::uint64_t outputHash = 0;
+			std::streamoff outputStart = 0;
+			if (isIncremental())
+			{
+				outputHash = proxyHash(type, type_name, basetype_name, interface_names, ifaceTypeList);
+				outputStart = file.tellp();
+				if (reuseOutput(outputKey, outputHash))
+				{
+					// Derived classes still need to know which methods this one defines (see writeMethods())
+					for (asUINT i = 0, count = type->GetMethodCount(); i < count; i++)
+						_inheritedDeclarations.insert(type->GetMethodDescriptorByIndex(i)->GetDeclaration(false));
+					recordOutput(outputKey, outputHash, outputStart);
+					return MaintainHierarchy(this);
+				}
+			}
+
 			// Write the standard stuff to the beginning of class
 			// Class type declaration
 			file << _linebegin << "class " + _typePrefix + type_name;
@@ -371,9 +552,18 @@ namespace ScriptUtils { namespace Inheritance
 			// Close the class scope
 			file << _linebegin << "}" << _lineend;
 
+			if (isIncremental())
+				recordOutput(outputKey, outputHash, outputStart);
+
 			return MaintainHierarchy(this);
 		}
 
+		//! Returns true if the output is incremental (see the constructor)
+		bool isIncremental() const
+		{
+			return !_manifestFilename.empty();
+		}
+
 	protected:
 		//! Adds identifiers (where necessary) to the params of a declaration
 		/*!
@@ -610,6 +800,161 @@ namespace ScriptUtils { namespace Inheritance
 			}
 		}
 
+		//! Where a generated type was written in the output, and the hash of what it was generated from
+		struct manifest_entry
+		{
+			std::uint64_t hash;
+			size_t offset;
+			size_t length;
+		};
+		typedef std::unordered_map<std::string, manifest_entry> manifest_map;
+
+		//! Reads the manifest and output of the previous run
+		void loadManifest()
+		{
+			std::ifstream manifest(_manifestFilename.c_str());
+			std::string line;
+			if (!std::getline(manifest, line) || line != manifestHeader())
+				return;
+			while (std::getline(manifest, line))
+			{
+				std::istringstream fields(line);
+				std::string hash, key;
+				manifest_entry entry;
+				if (fields >> hash >> entry.offset >> entry.length && std::getline(fields >> std::ws, key))
+				{
+					entry.hash = std::strtoull(hash.c_str(), NULL, 16);
+					_previousManifest[key] = entry;
+				}
+			}
+			if (!readFile(_outputFilename, _previousOutput))
+				_previousManifest.clear();
+		}
+
+		//! Writes the type's output from the previous run, if it was generated from the same things
+		bool reuseOutput(const std::string &key, std::uint64_t hash)
+		{
+			manifest_map::const_iterator previous = _previousManifest.find(key);
+			if (previous == _previousManifest.end() || previous->second.hash != hash ||
+				previous->second.offset + previous->second.length > _previousOutput.length())
+				return false;
+			file.write(_previousOutput.data() + previous->second.offset, previous->second.length);
+			return true;
+		}
+
+		//! Adds the type written since start to the manifest
+		void recordOutput(const std::string &key, std::uint64_t hash, std::streamoff start)
+		{
+			manifest_entry entry;
+			entry.hash = hash;
+			entry.offset = size_t(start);
+			entry.length = size_t(std::streamoff(file.tellp()) - start);
+			_manifest.push_back(std::make_pair(key, entry));
+		}
+
+		//! Replaces the output file with the new output (if it changed), and writes the manifest
+		/*!
+		* Only called from the destructor, so it doesn't throw: if something
+		* can't be written the next run just regenerates everything.
+		*/
+		void commitOutput()
+		{
+			if (!isIncremental() || !file.is_open())
+				return;
+			file.close();
+
+			const std::string tempFilename = _outputFilename + ".tmp";
+			std::string output, existing;
+			if (!readFile(tempFilename, output))
+				return;
+			if (readFile(_outputFilename, existing) && existing == output)
+				std::remove(tempFilename.c_str());
+			else
+			{
+				std::remove(_outputFilename.c_str());
+				if (std::rename(tempFilename.c_str(), _outputFilename.c_str()) != 0)
+					return;
+			}
+
+			std::ostringstream manifest;
+			manifest << manifestHeader() << "\n";
+			for (std::vector<std::pair<std::string, manifest_entry>>::const_iterator it = _manifest.begin(), end = _manifest.end(); it != end; ++it)
+			{
+				manifest << std::hex;
+				manifest.width(16);
+				manifest.fill('0');
+				manifest << it->second.hash << std::dec << " " << it->second.offset << " " << it->second.length << " " << it->first << "\n";
+			}
+			std::string previousManifest;
+			if (!readFile(_manifestFilename, previousManifest) || previousManifest != manifest.str())
+			{
+				std::ofstream manifestFile(_manifestFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+				manifestFile << manifest.str();
+			}
+		}
+
+		static const char *manifestHeader()
+		{
+			return "# ScriptUtils ProxyGenerator manifest 3";
+		}
+
+		static bool readFile(const std::string &filename, std::string &out)
+		{
+			std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+			if (!in)
+				return false;
+			out.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			return true;
+		}
+
+		//! Adds the settings that affect all the output to the hash
+		void hashSettings(SignatureHash &hash) const
+		{
+			hash.add_value(_output_type);
+			hash.add(_typePrefix).add(_identPrefix).add(_innerPrefix);
+			hash.add(_linebegin).add(_lineend).add(_tab);
+		}
+
+		//! Hashes everything the output of Generate() depends on
+		std::uint64_t proxyHash(asIObjectType *type, const char *type_name, const char *basetype_name, const char *interface_names, const interface_list &interfaces) const
+		{
+			SignatureHash hash;
+			hashSettings(hash);
+			hash.add(type_name).add(basetype_name).add(interface_names);
+			for (asUINT i = 0, count = type->GetMethodCount(); i < count; i++)
+				hash.add(type->GetMethodDescriptorByIndex(i)->GetDeclaration(false));
+			for (interface_list::const_iterator it = interfaces.begin(), end = interfaces.end(); it != end; ++it)
+			{
+				hash.add((*it)->GetName());
+				for (asUINT i = 0, count = (*it)->GetMethodCount(); i < count; i++)
+					hash.add((*it)->GetMethodDescriptorByIndex(i)->GetDeclaration(false));
+			}
+			// Methods already written by base classes are left out of derived ones
+			std::vector<std::string> inherited(_inheritedDeclarations.begin(), _inheritedDeclarations.end());
+			std::sort(inherited.begin(), inherited.end());
+			for (std::vector<std::string>::const_iterator it = inherited.begin(), end = inherited.end(); it != end; ++it)
+				hash.add(*it);
+			return hash.get();
+		}
+
+		//! Hashes everything the output of GenerateCppWrapper() depends on
+		std::uint64_t cppWrapperHash(asIObjectType *type, bool is_interface) const
+		{
+			SignatureHash hash;
+			hashSettings(hash);
+			hash.add(type->GetName()).add_value(is_interface ? 1 : 0);
+			for (asUINT i = 0, count = type->GetMethodCount(); i < count; i++)
+			{
+				asIScriptFunction *method = type->GetMethodByIndex(i);
+				hash.add(method->GetDeclaration(false)).add(method->GetName());
+			}
+			std::vector<std::pair<std::string, std::string>> cppTypeNames(_cppTypeNames.begin(), _cppTypeNames.end());
+			std::sort(cppTypeNames.begin(), cppTypeNames.end());
+			for (std::vector<std::pair<std::string, std::string>>::const_iterator it = cppTypeNames.begin(), end = cppTypeNames.end(); it != end; ++it)
+				hash.add(it->first).add(it->second);
+			return hash.get();
+		}
+
 		//! Writes method members of the given type to the file
 		//! \todo Param for _inner (rather than making that a member variable)
 		void writeMethods(asIObjectType *type)
@@ -659,6 +1004,97 @@ namespace ScriptUtils { namespace Inheritance
 			}
 		}
 
+		//! Returns the C++ type used for the given (non-handle, non-reference) script type
+		std::string cppTypeName(int typeId)
+		{
+			switch (typeId & ~(asTYPEID_OBJHANDLE | asTYPEID_HANDLETOCONST))
+			{
+			case asTYPEID_VOID: return "void";
+			case asTYPEID_BOOL: return "bool";
+			case asTYPEID_INT8: return "signed char";
+			case asTYPEID_INT16: return "short";
+			case asTYPEID_INT32: return "int";
+			case asTYPEID_INT64: return "asINT64";
+			case asTYPEID_UINT8: return "asBYTE";
+			case asTYPEID_UINT16: return "asWORD";
+			case asTYPEID_UINT32: return "asUINT";
+			case asTYPEID_UINT64: return "asQWORD";
+			case asTYPEID_FLOAT: return "float";
+			case asTYPEID_DOUBLE: return "double";
+			}
+
+			if ((typeId & asTYPEID_MASK_OBJECT) == 0)
+			{
+				// Enum
+				auto _where = _cppTypeNames.find(_engine->GetTypeDeclaration(typeId));
+				return _where != _cppTypeNames.end() ? _where->second : "int";
+			}
+
+			asIObjectType *type = _engine->GetObjectTypeById(typeId);
+			if (type == NULL || (type->GetFlags() & asOBJ_SCRIPT_OBJECT) != 0)
+				return "asIScriptObject";
+			auto _where = _cppTypeNames.find(type->GetName());
+			return _where != _cppTypeNames.end() ? _where->second : type->GetName();
+		}
+
+		//! Writes a method of a class generated by GenerateCppWrapper()
+		/*!
+		* Object params are passed as references (CallerBase#set_arg() only copies
+		* them where the script param needs a copy), handles as pointers (which
+		* set_arg() passes with SetArgObject(), adding the reference the script
+		* releases), and params the script writes to (&out / &inout) by address.
+		* Returned handles are ScriptHandle objects, since the context releases
+		* its reference when the call is over, and primitives returned by
+		* reference are returned as pointers.
+		*/
+		void writeCppMethod(asIScriptFunction *method, int index)
+		{
+			std::string params, args;
+			for (asUINT i = 0, count = method->GetParamCount(); i < count; ++i)
+			{
+				asDWORD flags = 0;
+				int typeId = method->GetParamTypeId(i, &flags);
+				std::string ident = _identPrefix + boost::lexical_cast<std::string>(i + 1);
+				std::string type = cppTypeName(typeId);
+				const bool isRef = (flags & asTM_INOUTREF) != 0;
+				const bool isConst = (flags & asTM_CONST) != 0 || (flags & asTM_INOUTREF) == asTM_INREF;
+
+				if (typeId & asTYPEID_OBJHANDLE)
+					type += "*";
+				else if (typeId & asTYPEID_MASK_OBJECT)
+					type = ((isConst || !isRef) ? "const " : "") + type + " &";
+				else if (isRef && !isConst)
+					type += " &";
+
+				if (i > 0)
+				{
+					params += ", ";
+					args += ", ";
+				}
+				params += type + " " + ident;
+				// Primitive references, and objects the script writes to, are set as addresses
+				const bool byAddress = (typeId & asTYPEID_MASK_OBJECT) ? (isRef && !isConst && !(typeId & asTYPEID_OBJHANDLE)) : isRef;
+				args += byAddress ? "&" + ident : ident;
+			}
+
+			asDWORD retFlags = 0;
+			int retId = method->GetReturnTypeId(&retFlags);
+			std::string ret = cppTypeName(retId);
+			if (retId & asTYPEID_OBJHANDLE)
+				ret = "ScriptUtils::Calling::ScriptHandle<" + ret + ">";
+			else if ((retId & asTYPEID_MASK_OBJECT) == 0 && (retFlags & asTM_INOUTREF) != 0)
+				// The return slot holds the address of the value, not the value
+				ret = ((retFlags & asTM_CONST) ? "const " : "") + ret + "*";
+
+			file << _linebegin << _tab << ret << " " << method->GetName() << "(" << params << ") { ";
+			if (retId != asTYPEID_VOID)
+				file << "return ";
+			file << "call_method<" << ret << ">(_bound[" << index << "]";
+			if (!args.empty())
+				file << ", " << args;
+			file << "); }" << _lineend;
+		}
+
 		//! Generates a class derived from the last one generated
 		MaintainHierarchy GenerateDerived(const char *type_name, const char *interface_names)
 		{
@@ -710,12 +1146,22 @@ namespace ScriptUtils { namespace Inheritance
 		// Characters before each line of the output
 		std::string _outputIndent;
 
+		// C++ names of registered types, for cppwrapper output
+		std::unordered_map<std::string, std::string> _cppTypeNames;
+
 		// Strings used throughout the file
 		std::string _linebegin;
 		std::string _lineend;
 		std::string _tab;
 		std::string _emptyline;
 
+		// Incremental output (see the constructor)
+		std::string _outputFilename;
+		std::string _manifestFilename;
+		manifest_map _previousManifest;
+		std::string _previousOutput;
+		std::vector<std::pair<std::string, manifest_entry>> _manifest;
+
 	};
 
 	MaintainHierarchy::MaintainHierarchy(ProxyGenerator *gen)
@@ -10,19 +10,109 @@
 #include <angelscript.h>
 
 #include "../Exception.h"
+#include "../Engine/TypeRegistry.h"
 
+#include <string>
 #include <type_traits>
 
 namespace ScriptUtils { namespace Inheritance
 {
 
+	//! Specialise (as std::true_type) for each class that declares its own classof() (see cast_ref())
+	/*!
+	* An opt-in is needed since a classof() inherited from a base can't be
+	* told apart from one the class declares, and a derived class using its
+	* base's classof() would be static_cast from objects that aren't of it.
+	*/
+	template <class T>
+	struct uses_classof : std::false_type
+	{};
+
+	//! True if _To opted in to tag-based casts, and has a <code>static bool classof(const _From*)</code> (see cast_ref())
+	template <class _From, class _To>
+	struct has_classof
+	{
+	private:
+		template <class T>
+		static auto test(int) -> decltype(T::classof(static_cast<const _From*>(NULL)), std::true_type());
+		template <class T>
+		static std::false_type test(...);
+	public:
+		static const bool value = uses_classof<_To>::value && decltype(test<_To>(0))::value;
+	};
+
+	//! True if a _From pointer can be static_cast to a _To pointer (i.e. not through a virtual base)
+	template <class _From, class _To>
+	struct is_static_castable
+	{
+	private:
+		template <class F, class T>
+		static auto test(int) -> decltype(static_cast<T*>(static_cast<F*>(NULL)), std::true_type());
+		template <class F, class T>
+		static std::false_type test(...);
+	public:
+		static const bool value = decltype(test<_From, _To>(0))::value;
+	};
+
+	//! Casts a pointer within a class hierarchy, without RTTI where possible
+	/*!
+	* Up-casts are always static. Down-casts use dynamic_cast, unless the
+	* hierarchy opts in to tag-based casts (LLVM-style isa / dyn_cast) by
+	* giving each class a <code>classof()</code> that checks a tag stored in
+	* the base class:
+	*
+	* \code
+	* class Entity
+	* {
+	* public:
+	* 	enum Kind { EntityKind, ActorKind, PlayerKind, ActorKindEnd };
+	* 	Kind GetKind() const { return kind; }
+	* 	static bool classof(const Entity *) { return true; }
+	* 	...
+	* };
+	* class Actor : public Entity
+	* {
+	* public:
+	* 	static bool classof(const Entity *e) { return e->GetKind() >= ActorKind && e->GetKind() < ActorKindEnd; }
+	* 	...
+	* };
+	* template <> struct ScriptUtils::Inheritance::uses_classof<Actor> : std::true_type {};
+	* \endcode
+	*
+	* The object is then checked with <code>_To::classof(obj)</code> and
+	* static_cast, which just applies the (compile-time) offset of the base.
+	* Only classes for which uses_classof is specialised are cast this way
+	* (so a class that doesn't declare its own classof() isn't cast using its
+	* base's); the rest, and hierarchies with virtual bases, use dynamic_cast
+	* for down-casts.
+	*/
+	template <class _To, class _From>
+	_To * cast_ref(_From * obj, typename std::enable_if<std::is_convertible<_From*, _To*>::value>::type* = NULL)
+	{
+		return obj;
+	}
+
+	template <class _To, class _From>
+	_To * cast_ref(_From * obj, typename std::enable_if<!std::is_convertible<_From*, _To*>::value &&
+		has_classof<_From, _To>::value && is_static_castable<_From, _To>::value>::type* = NULL)
+	{
+		return obj != NULL && _To::classof(obj) ? static_cast<_To*>(obj) : NULL;
+	}
+
+	template <class _To, class _From>
+	_To * cast_ref(_From * obj, typename std::enable_if<!std::is_convertible<_From*, _To*>::value &&
+		!(has_classof<_From, _To>::value && is_static_castable<_From, _To>::value)>::type* = NULL)
+	{
+		return dynamic_cast<_To*>(obj);
+	}
+
 	template <class _From, class _To>
 	_To * convert_ref(_From * obj) // fn param (so fn. other than 'AddReference' can be used)
 	{
 		if (obj == NULL)
 			return NULL;
 
-		_To* ret = dynamic_cast<_To*>(obj);
+		_To* ret = cast_ref<_To>(obj);
 		if (ret != NULL)
 		{
 			ret->AddReference();
@@ -33,6 +123,8 @@ namespace ScriptUtils { namespace Inheritance
 	//! Registers conversion operators for two ref. counted application objects
 	/*!
 	* Both objects must be registered <em>application objects</em>, not script objects.<br>
+	* The casts are done by cast_ref(), so classes that declare classof()
+	* (and specialise uses_classof) are cast without dynamic_cast.
 	*/
 	template <class _Base, class _Derived>
 	void RegisterBaseOf(asIScriptEngine *engine, const std::string& base, const std::string& derived)
@@ -51,6 +143,100 @@ namespace ScriptUtils { namespace Inheritance
 			throw Exception("Failed to register script implicit cast from " + derived + " to " + base + "");
 	}
 
+	//! Registers the casts between two classes of a hierarchy (if one derives from the other)
+	template <class _A, class _B, class Enable = void>
+	struct HierarchyPair
+	{
+		static void Register(asIScriptEngine *, const std::string &, const std::string &) {}
+	};
+
+	template <class _A, class _B>
+	struct HierarchyPair<_A, _B, typename std::enable_if<std::is_base_of<_A, _B>::value && !std::is_same<_A, _B>::value>::type>
+	{
+		static void Register(asIScriptEngine *engine, const std::string &a, const std::string &b)
+		{
+			RegisterBaseOf<_A, _B>(engine, a, b);
+		}
+	};
+
+	template <class _A, class _B>
+	struct HierarchyPair<_A, _B, typename std::enable_if<std::is_base_of<_B, _A>::value && !std::is_same<_A, _B>::value>::type>
+	{
+		static void Register(asIScriptEngine *engine, const std::string &a, const std::string &b)
+		{
+			RegisterBaseOf<_B, _A>(engine, b, a);
+		}
+	};
+
+	//! Registers the casts between every related pair of classes in the list
+	template <class... _Classes>
+	struct HierarchyConversions;
+
+	template <>
+	struct HierarchyConversions<>
+	{
+		static void Register(asIScriptEngine *, const std::string *) {}
+	};
+
+	template <class _Class, class... _Rest>
+	struct HierarchyConversions<_Class, _Rest...>
+	{
+		//! names[0] is the name of _Class, followed by the names of _Rest
+		static void Register(asIScriptEngine *engine, const std::string *names)
+		{
+			size_t i = 1;
+			const int expand[] = { 0, (HierarchyPair<_Class, _Rest>::Register(engine, names[0], names[i++]), 0)... };
+			(void)expand;
+			(void)i;
+			HierarchyConversions<_Rest...>::Register(engine, names + 1);
+		}
+	};
+
+	template <class _Class>
+	struct hierarchy_name_param { typedef const std::string &type; };
+
+	//! Returns the declaration of the script type T is registered as
+	template <class T>
+	std::string registered_type_name(asIScriptEngine *engine, const TypeRegistry &registry)
+	{
+		int typeId = registry.GetType<T>();
+		const char *decl = typeId >= 0 ? engine->GetTypeDeclaration(typeId, true) : NULL;
+		if (decl == NULL)
+			throw Exception(std::string("RegisterHierarchy: ") + typeid(T).name() + " isn't in the TypeRegistry");
+		return decl;
+	}
+
+	//! Registers conversions between all the classes of a hierarchy
+	/*!
+	* Every class is given casts directly to and from each of its ancestors in
+	* the list (not just its immediate base), so a script casting an object to
+	* a distant base / descendant does it in one step. The list can be in any
+	* order; pairs of unrelated classes are skipped. As RegisterBaseOf(), the
+	* classes must be registered ref. counted application objects.
+	*
+	* \code
+	* RegisterHierarchy<Entity, Actor, Player, Item>(engine, "Entity", "Actor", "Player", "Item");
+	* \endcode
+	*/
+	template <class _Class, class... _Classes>
+	void RegisterHierarchy(asIScriptEngine *engine, typename hierarchy_name_param<_Class>::type name, typename hierarchy_name_param<_Classes>::type... names)
+	{
+		const std::string nameArray[] = { name, names... };
+		HierarchyConversions<_Class, _Classes...>::Register(engine, nameArray);
+	}
+
+	//! Registers conversions between all the classes of a hierarchy, using the names they're registered with
+	/*!
+	* The script type each class is registered as is looked up in the
+	* TypeRegistry; an Exception is thrown if one isn't there.
+	*/
+	template <class _Class, class... _Classes>
+	void RegisterHierarchy(asIScriptEngine *engine, const TypeRegistry &registry)
+	{
+		const std::string nameArray[] = { registered_type_name<_Class>(engine, registry), registered_type_name<_Classes>(engine, registry)... };
+		HierarchyConversions<_Class, _Classes...>::Register(engine, nameArray);
+	}
+
 }}
 
 #endif
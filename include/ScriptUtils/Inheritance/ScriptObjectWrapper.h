@@ -8,24 +8,48 @@
 #define H_SCRIPTUTILS_SCRIPTOBJECTWRAPPER
 
 #include "../Calling/Caller.h"
+#include "../Calling/ThreadContexts.h"
+#include "ScriptTypeMethods.h"
 #include "TypeTraits.h"
 
-#include <memory>
-#include <unordered_map>
+#include <cstring>
+#include <type_traits>
 
 
 namespace ScriptUtils { namespace Inheritance
 {
 
 	//! Helps class wrappers call script functions
+	/*!
+	* Methods are resolved through the ScriptTypeMethods table shared by all
+	* objects of the same type, so a wrapper only holds the object and a
+	* pointer to that table.
+	* <p>
+	* Use call() for methods that are called often (e.g. every frame): it runs
+	* the method on one of the calling thread's contexts (see ThreadContexts),
+	* so repeated calls don't create contexts or allocate. get_caller() makes a
+	* separate Caller, which needs a context of its own (borrowed from the
+	* engine's ContextPool, if it has one).
+	* </p>
+	* <p>
+	* Since call() keeps idle contexts on each thread that uses it, call
+	* Calling::ThreadContexts::ReleaseAll(engine) on those threads (including
+	* the main thread) before the engine is released.
+	* </p>
+	*
+	* \code
+	* static constexpr MethodKey update("void Update(float)");
+	* wrapper.call<void>(update, dt);
+	* \endcode
+	*/
 	class ScriptObjectWrapper
 	{
 	public:
 		//! Constructor
 		ScriptObjectWrapper(asIScriptObject * obj)
-			: _obj(obj)
+			: _obj(obj), _methods(nullptr)
 		{
-			init();
+			init(nullptr);
 		}
 		//! Constructor, with compatibility check
 		/*!
@@ -39,9 +63,9 @@ namespace ScriptUtils { namespace Inheritance
 		* The name of the interface type <code>obj</code> must implement.
 		*/
 		ScriptObjectWrapper(asIScriptObject * obj, const char * iface)
-			: _obj(obj), _iface(iface)
+			: _obj(obj), _methods(nullptr)
 		{
-			init();
+			init(iface);
 		}
 		//! Destructor
 		virtual ~ScriptObjectWrapper()
@@ -55,10 +79,74 @@ namespace ScriptUtils { namespace Inheritance
 
 		//! Creates a Caller for the given method
 		Calling::Caller get_caller(const char * decl)
+		{
+			return findOrCreate_caller(MethodKey(decl, std::strlen(decl)));
+		}
+
+		//! Creates a Caller for the given method
+		/*!
+		* Use a constexpr MethodKey for methods that are called often, so
+		* that the declaration isn't hashed every time.
+		*/
+		Calling::Caller get_caller(const MethodKey &decl)
 		{
 			return findOrCreate_caller(decl);
 		}
 
+		//! Calls the given method on the wrapped object
+		/*!
+		* Uses an idle context from this thread's ThreadContexts, which is
+		* given back when the call returns (nested calls each get their own).
+		* Script exceptions are thrown as Exception.
+		*
+		* \returns
+		* The method's return value, converted as by Caller#call(). Since the
+		* context releases returned handles and by-value objects when it's
+		* given back, R can't be a pointer to one of those (an Exception is
+		* thrown) - use ScriptHandle<T> instead.
+		*/
+		template <typename R, typename... Args>
+		R call(const MethodKey &decl, const Args&... args)
+		{
+			asIScriptFunction *method = get_method(decl);
+			if (method == NULL)
+				throw Exception(std::string(_obj != NULL ? _obj->GetObjectType()->GetName() : "null object") + " has no method " + decl.decl());
+			return call_method<R>(method, args...);
+		}
+
+		//! Calls a method of the wrapped object that has already been looked up (see get_method())
+		/*!
+		* Used by the C++ proxies ProxyGenerator writes, which look their
+		* methods up once when they're constructed.
+		*/
+		template <typename R, typename... Args>
+		R call_method(asIScriptFunction *method, const Args&... args)
+		{
+			if (method == NULL || _obj == NULL)
+				throw Exception("ScriptObjectWrapper: the method being called wasn't bound");
+
+			if (std::is_pointer<R>::value)
+			{
+				asDWORD flags = 0;
+				int typeId = method->GetReturnTypeId(&flags);
+				if (!Calling::DetachedReturn<R>::accepts(typeId, flags))
+					throw Exception(std::string("ScriptObjectWrapper: ") + method->GetDeclaration() +
+						" returns an object that's released with the context, so it can't be returned as a pointer - use ScriptHandle<T>");
+			}
+
+			Calling::ThreadContext ctx(_obj->GetEngine());
+			// Declared after ctx, so that it lets go of the context before it's given back
+			Calling::Caller caller(ctx, _obj, method);
+			caller.SetThrowOnException(true);
+			return caller.call<R>(args...);
+		}
+
+		//! Returns the given method, or nullptr if the object doesn't have it
+		asIScriptFunction *get_method(const MethodKey &decl) const
+		{
+			return _methods != nullptr ? _methods->get_method(decl) : nullptr;
+		}
+
 		asIScriptObject *get_script_object() const
 		{
 			return _obj;
@@ -67,71 +155,65 @@ namespace ScriptUtils { namespace Inheritance
 	private:
 		//! To be run during CTOR
 		/*!
-		* If _iface is set, the type of _obj is checked to make sure
-		* it implements the interface type (called _iface).
+		* If iface is given, the type of _obj is checked to make sure
+		* it implements the interface type (called iface). The result is
+		* cached in the type's ScriptTypeMethods.
 		*/
-		void init()
+		void init(const char *iface)
 		{
 			if (_obj != NULL)
 			{
 				_obj->AddRef();
+				_methods = ScriptTypeMethods::Get(_obj->GetObjectType());
 				
 				// Check that this type has the expected interface
-				if (!_iface.empty())
+				if (iface != NULL && iface[0] != '\0')
 				{
-					// Try to get the interface type
-					int ifaceId = _obj->GetEngine()->GetTypeIdByDecl(_iface.c_str());
-					if (ifaceId < 0)
-						throw Exception(_iface + " isn't a registered interface type-name");
-					asIObjectType *ifaceType = _obj->GetEngine()->GetObjectTypeById(ifaceId);
-
-					// Do the actual check
-					if (!base_implements(_obj->GetObjectType(), ifaceType))
-						throw Exception(std::string(_obj->GetObjectType()->GetName()) + " doesn't implement " + _iface);
+					switch (_methods->implements(MethodKey(iface, std::strlen(iface))))
+					{
+					case ScriptTypeMethods::UnknownInterface:
+						throw Exception(std::string(iface) + " isn't a registered interface type-name");
+					case ScriptTypeMethods::DoesntImplement:
+						throw Exception(std::string(_obj->GetObjectType()->GetName()) + " doesn't implement " + iface);
+					default:
+						break;
+					}
 				}
 			}
 		}
 
-		Calling::Caller findOrCreate_caller(const std::string &decl)
+		Calling::Caller findOrCreate_caller(const MethodKey &decl)
 		{
 			if (_obj == NULL)
 				return Calling::Caller();
 
-			auto _where = m_Callers.find(decl);
-			if (_where == m_Callers.end())
-			{
-				Calling::Caller caller = Calling::Caller::Create(_obj, decl.c_str());
-				m_Callers[decl] = caller.get_funcid();
-
-				return caller;
-			}
-			else
-			{
-				return Calling::Caller::CallerForMethodFuncId(_obj, _where->second);
-			}
+			return Calling::Caller(_obj->GetEngine(), _obj, _methods->get_method(decl));
 		}
 
 	protected:
+		//! Looks up each of the given methods (nullptr for those the object doesn't have)
+		void bind_methods(const MethodKey *decls, asIScriptFunction **methods, size_t count) const
+		{
+			for (size_t i = 0; i < count; ++i)
+				methods[i] = get_method(decls[i]);
+		}
+
 		void set_obj(asIScriptObject *obj)
 		{
 			_obj = obj;
 			if (obj != NULL)
 				obj->AddRef();
-			m_Callers.clear();
+			_methods = obj != NULL ? ScriptTypeMethods::Get(obj->GetObjectType()) : NULL;
 		}
 		asIScriptObject * _obj;
-		std::string _iface;
+		//! The methods of _obj's type
+		ScriptTypeMethods * _methods;
 
 	private:
-		//typedef std::shared_ptr<Calling::Caller> CallerPtr;
-		typedef std::unordered_map<std::string, int> caller_map;
-
 		//! Prevent copying
 		ScriptObjectWrapper(const ScriptObjectWrapper &);
 		//! Prevent copying
 		ScriptObjectWrapper & operator=(const ScriptObjectWrapper &);
-
-		caller_map m_Callers;
 	};
 
 }}
@@ -0,0 +1,263 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_SCRIPTTYPEMETHODS
+#define H_SCRIPTUTILS_SCRIPTTYPEMETHODS
+
+#include <angelscript.h>
+
+#include "TypeTraits.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+namespace ScriptUtils { namespace Inheritance
+{
+
+	//! A method declaration (or type name) with its hash, for looking up ScriptTypeMethods
+	/*!
+	* Keys made from string literals are hashed at compile time, so they can be
+	* declared once and used for every lookup:
+	* \code
+	* static constexpr MethodKey update("void Update(float)");
+	* \endcode
+	* A key only points to the string it was made from, so that string has to
+	* outlive it.
+	*/
+	class MethodKey
+	{
+	public:
+		template <size_t N>
+		constexpr MethodKey(const char (&decl)[N])
+			: _decl(decl), _hash(hash(decl, N - 1))
+		{}
+
+		constexpr MethodKey(const char *decl, size_t length)
+			: _decl(decl), _hash(hash(decl, length))
+		{}
+
+		MethodKey(const std::string &decl)
+			: _decl(decl.c_str()), _hash(hash(decl.c_str(), decl.length()))
+		{}
+
+		constexpr const char *decl() const { return _decl; }
+
+		constexpr std::uint32_t get_hash() const { return _hash; }
+
+		//! FNV-1a
+		static constexpr std::uint32_t hash(const char *str, size_t length, std::uint32_t h = 2166136261u)
+		{
+			return length == 0 ? h : hash(str + 1, length - 1, (h ^ std::uint32_t((unsigned char)*str)) * 16777619u);
+		}
+
+	private:
+		const char *_decl;
+		std::uint32_t _hash;
+	};
+
+	//! The methods of a script type, resolved once and shared by every object of that type
+	/*!
+	* Get() returns the table for a type; ScriptObjectWrapper uses it so that
+	* wrappers don't each resolve (and store) the methods they call.
+	* <p>
+	* Lookups don't lock: entries are only ever added (under a mutex, the first
+	* time a declaration is looked up) and are never changed or removed while
+	* the table exists. Declarations that the type doesn't have are cached too.
+	* </p>
+	*/
+	class ScriptTypeMethods
+	{
+	public:
+		//! Result of implements()
+		enum InterfaceResult
+		{
+			//! The name isn't a registered type
+			UnknownInterface = -1,
+			DoesntImplement = 0,
+			Implements = 1
+		};
+
+		//! Returns the (shared) table for the given type
+		/*!
+		* Tables live until Forget() / Clear() is called. A table for a type
+		* that has since been destroyed is replaced if a new type turns up at
+		* the same address.
+		*/
+		static ScriptTypeMethods *Get(asIObjectType *type)
+		{
+			if (type == nullptr)
+				return nullptr;
+
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			std::unique_ptr<ScriptTypeMethods> &methods = registry()[type];
+			if (!methods || methods->_typeId != type->GetTypeId())
+				methods.reset(new ScriptTypeMethods(type));
+			return methods.get();
+		}
+
+		//! Removes the table for the given type (e.g. before its module is discarded)
+		/*!
+		* Only call this once nothing is using the table (i.e. no wrappers for
+		* objects of the type exist).
+		*/
+		static void Forget(asIObjectType *type)
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			registry().erase(type);
+		}
+
+		//! Removes all tables (see Forget())
+		static void Clear()
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			registry().clear();
+		}
+
+		asIObjectType *get_type() const
+		{
+			return _type;
+		}
+
+		//! Returns the method with the given declaration, or nullptr if the type doesn't have it
+		asIScriptFunction *get_method(const MethodKey &key)
+		{
+			if (const entry *e = find(_methods[key.get_hash() % bucket_count], key))
+				return e->function;
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			std::atomic<entry*> &bucket = _methods[key.get_hash() % bucket_count];
+			// May have been added while waiting for the lock
+			if (const entry *e = find(bucket, key))
+				return e->function;
+			entry *e = add(bucket, key);
+			e->function = _type->GetMethodByDecl(key.decl());
+			publish(bucket, e);
+			return e->function;
+		}
+
+		//! Checks whether the type (or one of its bases) implements the named interface
+		InterfaceResult implements(const MethodKey &iface_name)
+		{
+			if (const entry *e = find(_interfaces, iface_name))
+				return e->implements;
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (const entry *e = find(_interfaces, iface_name))
+				return e->implements;
+			entry *e = add(_interfaces, iface_name);
+			asIScriptEngine *engine = _type->GetEngine();
+			int ifaceId = engine->GetTypeIdByDecl(iface_name.decl());
+			if (ifaceId < 0)
+				e->implements = UnknownInterface;
+			else
+				e->implements = base_implements(_type, engine->GetObjectTypeById(ifaceId)) ? Implements : DoesntImplement;
+			publish(_interfaces, e);
+			return e->implements;
+		}
+
+		~ScriptTypeMethods()
+		{
+			destroy(_interfaces);
+			for (size_t i = 0; i < bucket_count; ++i)
+				destroy(_methods[i]);
+		}
+
+	private:
+		//! Prevent copying
+		ScriptTypeMethods(const ScriptTypeMethods &);
+		//! Prevent copying
+		ScriptTypeMethods & operator=(const ScriptTypeMethods &);
+
+		static const size_t bucket_count = 16;
+
+		struct entry
+		{
+			std::uint32_t hash;
+			std::string decl;
+			asIScriptFunction *function;
+			InterfaceResult implements;
+			entry *next;
+
+			entry(const MethodKey &key)
+				: hash(key.get_hash()), decl(key.decl()), function(nullptr), implements(DoesntImplement), next(nullptr)
+			{}
+		};
+
+		explicit ScriptTypeMethods(asIObjectType *type)
+			: _type(type),
+			_typeId(type->GetTypeId()),
+			_interfaces(nullptr)
+		{
+			for (size_t i = 0; i < bucket_count; ++i)
+				_methods[i].store(nullptr, std::memory_order_relaxed);
+		}
+
+		static const entry *find(const std::atomic<entry*> &bucket, const MethodKey &key)
+		{
+			for (const entry *e = bucket.load(std::memory_order_acquire); e != nullptr; e = e->next)
+				if (e->hash == key.get_hash() && std::strcmp(e->decl.c_str(), key.decl()) == 0)
+					return e;
+			return nullptr;
+		}
+
+		static entry *add(std::atomic<entry*> &bucket, const MethodKey &key)
+		{
+			entry *e = new entry(key);
+			e->next = bucket.load(std::memory_order_relaxed);
+			return e;
+		}
+
+		//! Makes a filled-in entry visible to find()
+		static void publish(std::atomic<entry*> &bucket, entry *e)
+		{
+			bucket.store(e, std::memory_order_release);
+		}
+
+		static void destroy(std::atomic<entry*> &bucket)
+		{
+			entry *e = bucket.load(std::memory_order_relaxed);
+			while (e != nullptr)
+			{
+				entry *next = e->next;
+				delete e;
+				e = next;
+			}
+			bucket.store(nullptr, std::memory_order_relaxed);
+		}
+
+		typedef std::unordered_map<asIObjectType*, std::unique_ptr<ScriptTypeMethods>> registry_type;
+
+		static registry_type& registry()
+		{
+			static registry_type tables;
+			return tables;
+		}
+
+		static std::mutex& registry_mutex()
+		{
+			static std::mutex m;
+			return m;
+		}
+
+		asIObjectType *_type;
+		//! Type-ids aren't reused, so this tells a new type at the same address from the old one
+		int _typeId;
+
+		std::atomic<entry*> _methods[bucket_count];
+		std::atomic<entry*> _interfaces;
+		//! Serialises adding entries
+		std::mutex _mutex;
+	};
+
+}}
+
+#endif
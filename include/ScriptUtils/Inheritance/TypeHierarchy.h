@@ -0,0 +1,255 @@
+/*
+* ScriptUtils
+* By Elliot Hayward
+* Public Domain
+*/
+
+#ifndef H_SCRIPTUTILS_TYPEHIERARCHY
+#define H_SCRIPTUTILS_TYPEHIERARCHY
+
+#include <angelscript.h>
+
+#include "TypeTraits.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace ScriptUtils { namespace Inheritance
+{
+
+	//! The inheritance relationships between the types of a module (or engine), worked out in advance
+	/*!
+	* Build one after the module is built. Each type gets a dense index, and
+	* its bases and interfaces are stored as bitsets, so the queries here are
+	* a bit test (rather than walking GetBaseType() chains, or parsing the
+	* names as the module overloads in TypeTraits.h do).
+	* <p>
+	* The index doesn't change once it's built, so it can be shared between
+	* threads. It has to be rebuilt if the module is rebuilt. Types that
+	* weren't indexed fall back to the functions in TypeTraits.h.
+	* </p>
+	*
+	* \code
+	* TypeHierarchy hierarchy(module);
+	* if (hierarchy.base_implements("Player", "IUpdatable")) ...
+	* \endcode
+	*/
+	class TypeHierarchy
+	{
+	public:
+		static const size_t npos = ~size_t(0);
+
+		//! Indexes the types declared in the module (and their bases / interfaces)
+		explicit TypeHierarchy(asIScriptModule *module)
+		{
+			for (asUINT i = 0, count = module->GetObjectTypeCount(); i < count; ++i)
+				add(module->GetObjectTypeByIndex(i));
+			build();
+		}
+
+		//! Indexes the types registered with the engine (and their bases / interfaces)
+		explicit TypeHierarchy(asIScriptEngine *engine)
+		{
+			for (asUINT i = 0, count = engine->GetObjectTypeCount(); i < count; ++i)
+				add(engine->GetObjectTypeByIndex(i));
+			build();
+		}
+
+		//! Returns the number of types indexed
+		size_t size() const
+		{
+			return _types.size();
+		}
+
+		//! Returns the index of the type, or npos if it isn't indexed
+		size_t index_of(const asIObjectType *type) const
+		{
+			if (type == nullptr)
+				return npos;
+			size_t seq = sequence_number(type->GetTypeId());
+			if (seq >= _indexBySeq.size())
+				return npos;
+			size_t index = _indexBySeq[seq];
+			// A type from another engine can have the same sequence number
+			if (index == npos || _types[index] != type)
+				return npos;
+			return index;
+		}
+
+		//! Returns the index of the type with the given name, or npos if there isn't one
+		/*!
+		* Types in a namespace are named with it, e.g. "Game::Player".
+		*/
+		size_t index_of(const std::string &name) const
+		{
+			auto entry = _indexByName.find(name);
+			return entry != _indexByName.end() ? entry->second : npos;
+		}
+
+		asIObjectType *get_type(size_t index) const
+		{
+			return index < _types.size() ? _types[index] : nullptr;
+		}
+
+		//! Returns true if base is derived (or a base of it)
+		bool is_base_of(asIObjectType *base, asIObjectType *derived) const
+		{
+			size_t b = index_of(base), d = index_of(derived);
+			if (b == npos || d == npos)
+				return base != nullptr && derived != nullptr && Inheritance::is_base_of(base, derived);
+			return test(_ancestors, d, b);
+		}
+
+		bool is_base_of(const std::string &base_name, const std::string &derived_name) const
+		{
+			size_t b = index_of(base_name), d = index_of(derived_name);
+			return b != npos && d != npos && test(_ancestors, d, b);
+		}
+
+		//! Returns true if the given type implements the given interface
+		bool implements(asIObjectType *implementor, asIObjectType *iface) const
+		{
+			size_t t = index_of(implementor), i = index_of(iface);
+			if (t == npos || i == npos)
+				return implementor != nullptr && iface != nullptr && Inheritance::implements(implementor, iface);
+			return test(_interfaces, t, i);
+		}
+
+		bool implements(const std::string &implementor_name, const std::string &interface_name) const
+		{
+			size_t t = index_of(implementor_name), i = index_of(interface_name);
+			return t != npos && i != npos && test(_interfaces, t, i);
+		}
+
+		//! Returns true if this type or one of it's bases implements the given interface
+		bool base_implements(asIObjectType *derived, asIObjectType *iface) const
+		{
+			size_t t = index_of(derived), i = index_of(iface);
+			if (t == npos || i == npos)
+				return derived != nullptr && iface != nullptr && Inheritance::base_implements(derived, iface);
+			return test(_baseInterfaces, t, i);
+		}
+
+		bool base_implements(const std::string &derived_name, const std::string &interface_name) const
+		{
+			size_t t = index_of(derived_name), i = index_of(interface_name);
+			return t != npos && i != npos && test(_baseInterfaces, t, i);
+		}
+
+		//! Returns the base class that implements the given interface
+		asIObjectType* get_base_implementor(asIObjectType *derived, asIObjectType *iface) const
+		{
+			size_t t = index_of(derived), i = index_of(iface);
+			if (t == npos || i == npos)
+				return derived != nullptr && iface != nullptr ? Inheritance::get_base_implementor(derived, iface) : nullptr;
+			if (!test(_baseInterfaces, t, i))
+				return nullptr;
+			while (!test(_interfaces, t, i))
+				t = _bases[t];
+			return _types[t];
+		}
+
+	private:
+		typedef std::uint64_t word_type;
+		static const size_t word_bits = 64;
+
+		static size_t sequence_number(int typeId)
+		{
+			return size_t(typeId & asTYPEID_MASK_SEQNBR);
+		}
+
+		//! Returns the type's name, prefixed with its namespace (if it's in one)
+		static std::string qualified_name(const asIObjectType *type)
+		{
+			const char *ns = type->GetNamespace();
+			if (ns == nullptr || *ns == '\0')
+				return type->GetName();
+			return std::string(ns) + "::" + type->GetName();
+		}
+
+		//! Indexes the type, then its base and interfaces
+		void add(asIObjectType *type)
+		{
+			if (type == nullptr || index_of(type) != npos)
+				return;
+
+			size_t seq = sequence_number(type->GetTypeId());
+			if (seq >= _indexBySeq.size())
+				_indexBySeq.resize(seq + 1, size_t(npos));
+			_indexBySeq[seq] = _types.size();
+			// The first of any types with the same name wins
+			_indexByName.insert(std::make_pair(qualified_name(type), _types.size()));
+			_types.push_back(type);
+
+			add(type->GetBaseType());
+			for (asUINT i = 0; i < type->GetInterfaceCount(); ++i)
+				add(type->GetInterface(i));
+		}
+
+		//! Fills in the bitsets, once all the types have been indexed
+		void build()
+		{
+			const size_t count = _types.size();
+			_words = (count + word_bits - 1) / word_bits;
+			_ancestors.assign(count * _words, 0);
+			_interfaces.assign(count * _words, 0);
+			_baseInterfaces.assign(count * _words, 0);
+			_bases.assign(count, size_t(npos));
+
+			for (size_t t = 0; t < count; ++t)
+			{
+				asIObjectType *type = _types[t];
+				_bases[t] = index_of(type->GetBaseType());
+				// asIObjectType::Implements() is true for the type itself, so the fallback agrees
+				set(_interfaces, t, t);
+				for (asUINT i = 0; i < type->GetInterfaceCount(); ++i)
+					set(_interfaces, t, index_of(type->GetInterface(i)));
+			}
+
+			for (size_t t = 0; t < count; ++t)
+			{
+				word_type *inherited = &_baseInterfaces[t * _words];
+				for (size_t a = t; a != npos; a = _bases[a])
+				{
+					set(_ancestors, t, a);
+					const word_type *direct = &_interfaces[a * _words];
+					for (size_t w = 0; w < _words; ++w)
+						inherited[w] |= direct[w];
+				}
+			}
+		}
+
+		void set(std::vector<word_type> &bits, size_t row, size_t column)
+		{
+			bits[row * _words + column / word_bits] |= word_type(1) << (column % word_bits);
+		}
+
+		bool test(const std::vector<word_type> &bits, size_t row, size_t column) const
+		{
+			return (bits[row * _words + column / word_bits] & (word_type(1) << (column % word_bits))) != 0;
+		}
+
+		std::vector<asIObjectType*> _types;
+		//! Index of each type, by type-id sequence number
+		std::vector<size_t> _indexBySeq;
+		//! Index of each type, by qualified name (see qualified_name())
+		std::unordered_map<std::string, size_t> _indexByName;
+		//! Index of each type's base (npos if it has none)
+		std::vector<size_t> _bases;
+
+		//! Words per bitset row
+		size_t _words;
+		//! Row per type, with a bit set for the type itself and each of its bases
+		std::vector<word_type> _ancestors;
+		//! Row per type, with a bit set for each interface the type implements (and the type itself)
+		std::vector<word_type> _interfaces;
+		//! As _interfaces, including the interfaces implemented by the type's bases
+		std::vector<word_type> _baseInterfaces;
+	};
+
+}}
+
+#endif
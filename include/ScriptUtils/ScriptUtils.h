@@ -10,6 +10,7 @@
 
 #include "Exception.h"
 #include "Calling/Caller.h"
+#include "Calling/TypedCaller.h"
 #include "Inheritance/ScriptObjectWrapper.h"
 #include "Inheritance/ProxyGenerator.h"
 #include "Inheritance/CompleteHeaderGenerator.h"